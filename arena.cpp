@@ -0,0 +1,84 @@
+#include <assert.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "block_rmq.hpp"
+#include "naive_rmq.hpp"
+#include "opt_rmq.hpp"
+#include "pm_rmq.hpp"
+#include "sparse_rmq.hpp"
+
+typedef std::vector<int>::const_iterator iterator_type;
+typedef std::vector<int>::difference_type difference_type;
+
+/**
+ * Checks that impl built from an arena gives the same answers as one
+ * built on the heap, that its tables all came from the arena, and that
+ * it outlives the arena object.
+ */
+template<typename impl>
+void arena_test(const std::vector<int> &input) {
+  std::vector<std::pair<difference_type, difference_type> > queries;
+  for (size_t i = 0; i < 100000; ++i) {
+    const size_t u = size_t(std::rand()) % input.size();
+    const size_t v = u + 1 + size_t(std::rand()) % (input.size() - u);
+    queries.push_back(std::make_pair(difference_type(u), difference_type(v)));
+  }
+
+  impl heap(input.begin(), input.end());
+  std::vector<difference_type> heap_answers;
+  heap.query_batch(queries.begin(), queries.end(), std::back_inserter(heap_answers));
+
+  std::unique_ptr<impl> built;
+  {
+    // Small chunks, so that some tables get chunks of their own.
+    arena storage(4096);
+    built.reset(new impl(input.begin(), input.end(), 1, &storage));
+    assert(built->bytes_used() == heap.bytes_used());
+    assert(storage.bytes_reserved() >= built->bytes_used());
+  }
+
+  std::vector<difference_type> built_answers;
+  built->query_batch(queries.begin(), queries.end(), std::back_inserter(built_answers));
+  assert(built_answers == heap_answers);
+}
+
+int main(int argc, const char *argv[]) {
+  std::vector<int> input(100000);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+  std::vector<int> pm_input(100000);
+  for (size_t i = 1; i < pm_input.size(); ++i) {
+    pm_input[i] = pm_input[i - 1] + (std::rand() % 2 ? 1 : -1);
+  }
+
+  arena_test<sparse_rmq<iterator_type> >(input);
+  arena_test<sparse_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+  arena_test<pm_rmq<iterator_type> >(pm_input);
+  arena_test<opt_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+  arena_test<block_rmq<iterator_type> >(input);
+
+  {
+    // naive_rmq doesn't take threads.
+    const std::vector<int> small(input.begin(), input.begin() + 1000);
+    naive_rmq<iterator_type> heap(small.begin(), small.end());
+    std::unique_ptr<naive_rmq<iterator_type> > built;
+    {
+      arena storage;
+      built.reset(new naive_rmq<iterator_type>(small.begin(), small.end(), &storage));
+    }
+    for (difference_type u = 0; u < difference_type(small.size()); u += 7) {
+      for (difference_type v = u + 1; v <= difference_type(small.size()); v += 3) {
+        assert(built->query_offset(u, v) == heap.query_offset(u, v));
+      }
+    }
+  }
+  return 0;
+}
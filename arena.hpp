@@ -0,0 +1,120 @@
+/**
+ * Defines a monotonic arena the implementations can take their tables
+ * from, instead of allocating each one separately.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * Hands out memory from large chunks, bumping a pointer through the
+ * current chunk and starting a new one when it runs out.  Nothing is
+ * freed until the whole arena is: each implementation built from the
+ * arena keeps its chunks alive (so the arena itself can go away first),
+ * and the chunks are released together, one free per chunk, when the
+ * last of them is destroyed.
+ *
+ * That makes building an index take a few large allocations however
+ * many tables it has, and tearing it down just as few frees, which
+ * matters when indexes are rebuilt and swapped while others are being
+ * queried.
+ *
+ * An arena isn't thread safe.  The implementations only allocate from it
+ * on the thread calling their constructor, before any worker threads
+ * start, so one arena can be passed to a multi-threaded build, but not
+ * to several builds running at once.
+ */
+class arena {
+  /**
+   * The chunks, shared with every table carved from them.
+   */
+  struct chunk_list {
+    std::vector<char *> chunks;
+
+    ~chunk_list() {
+      for (char *chunk : chunks) {
+        operator delete(chunk);
+      }
+    }
+  };
+
+  std::shared_ptr<chunk_list> _chunks;
+  size_t _chunk_size;
+  size_t _reserved;
+
+  /**
+   * The unused part of the last chunk.
+   */
+  char *_next;
+  size_t _left;
+
+  char *new_chunk(size_t size) {
+    _chunks->chunks.reserve(_chunks->chunks.size() + 1);
+    char *chunk = static_cast<char *>(operator new(size));
+    _chunks->chunks.push_back(chunk);
+    _reserved += size;
+    return chunk;
+  }
+
+public:
+  /**
+   * Memory handed out is aligned to this many bytes, so that tables
+   * start on a cache line.
+   */
+  static const size_t alignment = 64;
+
+  /**
+   * An arena allocating chunks of chunk_size bytes, or larger for
+   * allocations that wouldn't fit in one.
+   */
+  explicit arena(size_t chunk_size = size_t(1) << 20)
+    : _chunks(std::make_shared<chunk_list>()),
+      _chunk_size(chunk_size),
+      _reserved(0),
+      _next(nullptr),
+      _left(0)
+  {}
+
+  arena(const arena &) = delete;
+  arena &operator=(const arena &) = delete;
+
+  /**
+   * Returns size bytes, aligned to alignment.
+   */
+  void *allocate(size_t size) {
+    const size_t padding = (alignment - uintptr_t(_next) % alignment) % alignment;
+    if (_next == nullptr || padding + size > _left) {
+      // An allocation that wouldn't leave room for much else in a chunk
+      // of its own gets one to itself, and the current chunk stays
+      // current.
+      if (size > _chunk_size / 2) {
+        char *chunk = new_chunk(size + alignment - 1);
+        return chunk + (alignment - uintptr_t(chunk) % alignment) % alignment;
+      }
+      _next = new_chunk(_chunk_size);
+      _left = _chunk_size;
+      return allocate(size);
+    }
+    char *p = _next + padding;
+    _next = p + size;
+    _left -= padding + size;
+    return p;
+  }
+
+  /**
+   * Something to hold onto to keep the memory handed out so far alive.
+   */
+  std::shared_ptr<const void> keepalive() const {
+    return _chunks;
+  }
+
+  /**
+   * The total size of the chunks allocated so far.
+   */
+  size_t bytes_reserved() const { return _reserved; }
+};
@@ -0,0 +1,20 @@
+#include "block_rmq.hpp"
+#include "rmq_test.hpp"
+
+// Blocks smaller than a vector, which don't divide the test inputs'
+// lengths either.
+template<typename iterator_type>
+using small_block_rmq =
+  block_rmq<iterator_type,
+            typename std::iterator_traits<iterator_type>::value_type,
+            typename std::iterator_traits<iterator_type>::difference_type,
+            typename std::iterator_traits<iterator_type>::difference_type,
+            3>;
+
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(block_rmq, 1000000);
+  RMQ_NARROW_TEST_BODY(block_rmq, 1000000);
+  rmq_test::threaded_test<block_rmq<std::vector<int>::const_iterator>>();
+  RMQ_TEST_BODY(small_block_rmq, 1000000);
+  return 0;
+}
@@ -0,0 +1,253 @@
+/**
+ * Implements a practical <O(n), O(B)> RMQ solution: blocks of B
+ * consecutive elements answered by scanning, plus a sparse_rmq over the
+ * blocks' minima.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+#include "parallel.hpp"
+#include "rmq.hpp"
+#include "serialize.hpp"
+#include "simd.hpp"
+#include "table.hpp"
+
+#include "sparse_rmq.hpp"
+
+/**
+ * This is pm_rmq's super array idea applied to general input: instead of
+ * precomputing answers inside blocks, we just scan them, which for a
+ * block of a cache line or two of values is about as fast as a table
+ * lookup and needs no table at all.  That leaves the sparse table over
+ * the n/B block minima as nearly all of the space, about (n/B)lg(n/B)
+ * indexes rather than sparse_rmq's n lg(n).
+ *
+ * block_size is B, and comes after the usual template parameters so
+ * that it can have a default.  The default makes a block of ints one
+ * cache line, larger blocks make the structure smaller still but
+ * queries slower.
+ */
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type,
+  size_t block_size=16
+  >
+class block_rmq : public rmq<block_rmq<iterator_type, value_type, difference_type, index_type, block_size>,
+                              iterator_type, value_type, difference_type> {
+
+  static_assert(block_size > 0, "blocks can't be empty");
+
+  typedef rmq<block_rmq, iterator_type, value_type, difference_type> rmq_base;
+
+  // Compilers are dumb.
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+  using rmq_base::prefetch;
+
+  static const difference_type bs = block_size;
+
+  /**
+   * The minimum value in each block, and its position (as an offset from
+   * the beginning of the input).  Positions are stored as index_type,
+   * which can be narrower than difference_type to save space as long as
+   * it can hold n().
+   */
+  table<value_type> _block_min_vals;
+  table<index_type> _block_min_idxs;
+
+  /**
+   * The sparse RMQ implementation over _block_min_vals, which stores its
+   * indexes as index_type too.
+   */
+  typedef typename table<value_type>::const_iterator block_iterator_type;
+  typedef sparse_rmq<block_iterator_type, value_type,
+                     typename std::iterator_traits<block_iterator_type>::difference_type,
+                     index_type> block_min_rmq_type;
+  std::unique_ptr<block_min_rmq_type> _block_min_rmq;
+
+  /**
+   * Returns the offset of the leftmost minimum in [lo, hi), which should
+   * lie within one block.
+   */
+  difference_type scan(difference_type lo, difference_type hi) const {
+    return scan(lo, hi, std::integral_constant<bool, simd::packable<iterator_type>::value>());
+  }
+
+  difference_type scan(difference_type lo, difference_type hi, std::false_type) const {
+    return std::min_element(begin() + lo, begin() + hi) - begin();
+  }
+
+  /**
+   * The same, for contiguous arithmetic values, which simd can compare
+   * many at a time.  When a block fits in a cache line, simd::block_argmin
+   * can scan the whole (full, so not the last) block with a mask, which it
+   * does without any data-dependent branches.  Larger blocks just have
+   * [lo, hi) scanned, since loading all of them would touch lines the
+   * query doesn't need.
+   */
+  difference_type scan(difference_type lo, difference_type hi, std::true_type) const {
+    const difference_type block_begin = lo - lo % bs;
+    if (block_size * sizeof(value_type) <= 64 && block_begin + bs <= n()) {
+      return block_begin + difference_type(simd::block_argmin<block_size>(&*(begin() + block_begin),
+                                                                          lo - block_begin,
+                                                                          hi - block_begin));
+    }
+    return lo + difference_type(simd::argmin(&*(begin() + lo), size_t(hi - lo)));
+  }
+
+  /**
+   * Finds the minimum of blocks [lo, hi).
+   */
+  void scan_blocks(difference_type lo, difference_type hi) {
+    for (difference_type k = lo; k < hi; ++k) {
+      const difference_type min_idx = scan(k * bs, std::min(n(), (k + 1) * bs));
+      _block_min_vals[k] = val(min_idx);
+      _block_min_idxs[k] = min_idx;
+    }
+  }
+
+  /**
+   * Combines the answers for the partial blocks at either end of a query
+   * (u's block to its end and v's block from its beginning) with the
+   * blocks strictly between them.
+   */
+  difference_type combine(difference_type u_min_idx, difference_type v_min_idx,
+                          difference_type u_block_idx, difference_type v_block_idx,
+                          difference_type block_min_idx) const {
+    const difference_type ends_min_idx = val(v_min_idx) < val(u_min_idx) ? v_min_idx : u_min_idx;
+    if (v_block_idx - u_block_idx == 1) {
+      return ends_min_idx;
+    }
+    return _block_min_vals[block_min_idx] < val(ends_min_idx)
+      ? difference_type(_block_min_idxs[block_min_idx])
+      : ends_min_idx;
+  }
+
+public:
+  /**
+   * Preprocess the array [b,e) for RMQ queries, using up to threads
+   * threads, and taking the tables (including the block minima's
+   * sparse_rmq's) from storage if it's given.
+   */
+  block_rmq(iterator_type b, iterator_type e, unsigned threads = 1,
+            arena *storage = nullptr)
+    : rmq_base(b, e)
+  {
+    const difference_type num_blocks = (n() + bs - 1) / bs;
+    _block_min_vals = table<value_type>(num_blocks, storage);
+    _block_min_idxs = table<index_type>(num_blocks, storage);
+    parallel_for(0, num_blocks, threads,
+                 [this](size_t lo, size_t hi) {
+                   scan_blocks(lo, hi);
+                 }, 64);
+
+    _block_min_rmq.reset(new block_min_rmq_type(_block_min_vals.cbegin(), _block_min_vals.cend(),
+                                                threads, storage));
+  }
+
+  /**
+   * Loads the tables for the array [b,e) saved by save(), viewing them in
+   * place.  See serialize.hpp.
+   */
+  block_rmq(iterator_type b, iterator_type e, index_reader &in)
+    : rmq_base(b, e)
+  {
+    const difference_type num_blocks = (n() + bs - 1) / bs;
+    in.read_header<value_type, index_type>(index_kind::block, n(), block_size);
+    _block_min_vals = in.read_table<value_type>(num_blocks);
+    _block_min_idxs = in.read_table<index_type>(num_blocks);
+    _block_min_rmq.reset(new block_min_rmq_type(_block_min_vals.cbegin(), _block_min_vals.cend(), in));
+  }
+
+  void save(index_writer &out) const {
+    out.write_header<value_type, index_type>(index_kind::block, n(), block_size);
+    out.write_table(_block_min_vals);
+    out.write_table(_block_min_idxs);
+    _block_min_rmq->save(out);
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("block_minima", _block_min_vals.bytes_used() + _block_min_idxs.bytes_used());
+    usage.add("block_min_rmq", _block_min_rmq->memory_usage());
+    return usage;
+  }
+
+  difference_type query(iterator_type u, iterator_type v) const {
+    const difference_type uo = u - begin();
+    const difference_type vo = v - begin();
+    const difference_type u_block_idx = uo / bs;
+    const difference_type v_block_idx = (vo - 1) / bs;
+    if (u_block_idx == v_block_idx) {
+      return scan(uo, vo);
+    }
+
+    // Don't query the block minima when u's and v's blocks are adjacent,
+    // sparse_rmq doesn't handle zero-length intervals.
+    const difference_type u_min_idx = scan(uo, (u_block_idx + 1) * bs);
+    const difference_type v_min_idx = scan(v_block_idx * bs, vo);
+    const difference_type block_min_idx = v_block_idx - u_block_idx > 1
+      ? _block_min_rmq->query_offset(u_block_idx + 1, v_block_idx)
+      : 0;
+    return combine(u_min_idx, v_min_idx, u_block_idx, v_block_idx, block_min_idx);
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    // Prefetch both ends of every query's scans and gather the queries
+    // that span whole blocks into a chunk for _block_min_rmq, then scan
+    // and combine.
+    difference_type u_block_idxs[rmq_base::chunk_size];
+    difference_type v_block_idxs[rmq_base::chunk_size];
+    difference_type block_uos[rmq_base::chunk_size];
+    difference_type block_vos[rmq_base::chunk_size];
+    size_t block_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      u_block_idxs[i] = uos[i] / bs;
+      v_block_idxs[i] = (vos[i] - 1) / bs;
+      prefetch(&val(uos[i]));
+      prefetch(&val(vos[i] - 1));
+      if (v_block_idxs[i] != u_block_idxs[i]) {
+        prefetch(&val((u_block_idxs[i] + 1) * bs - 1));
+        prefetch(&val(v_block_idxs[i] * bs));
+      }
+      if (v_block_idxs[i] - u_block_idxs[i] > 1) {
+        block_uos[block_count] = u_block_idxs[i] + 1;
+        block_vos[block_count] = v_block_idxs[i];
+        ++block_count;
+      }
+    }
+
+    difference_type block_min_idxs[rmq_base::chunk_size];
+    if (block_count > 0) {
+      _block_min_rmq->query_chunk(block_uos, block_vos, block_count, block_min_idxs);
+    }
+    for (size_t i = 0; i < block_count; ++i) {
+      prefetch(&_block_min_vals[block_min_idxs[i]]);
+    }
+
+    size_t block_i = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (u_block_idxs[i] == v_block_idxs[i]) {
+        out[i] = scan(uos[i], vos[i]);
+      } else {
+        const difference_type u_min_idx = scan(uos[i], (u_block_idxs[i] + 1) * bs);
+        const difference_type v_min_idx = scan(v_block_idxs[i] * bs, vos[i]);
+        const difference_type block_min_idx = v_block_idxs[i] - u_block_idxs[i] > 1
+          ? block_min_idxs[block_i++]
+          : 0;
+        out[i] = combine(u_min_idx, v_min_idx, u_block_idxs[i], v_block_idxs[i], block_min_idx);
+      }
+    }
+  }
+};
@@ -0,0 +1,102 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "dynamic_rmq.hpp"
+
+typedef dynamic_rmq<int> impl;
+typedef impl::iterator_type iterator_type;
+typedef std::ptrdiff_t difference_type;
+
+/**
+ * Checks random queries of length up to max_len against the leftmost
+ * minimum found by brute force.
+ */
+static void check(const impl &im, size_t queries, difference_type max_len) {
+  for (size_t q = 0; q < queries; ++q) {
+    const difference_type u = std::rand() % im.n();
+    const difference_type v = u + 1 + std::rand() % std::min(max_len, im.n() - u);
+    const iterator_type expected = std::min_element(im.begin() + u, im.begin() + v);
+    assert(im.query(im.begin() + u, im.begin() + v) == expected - im.begin());
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  {
+    const int input[] = { 10, 8, 9, 2, 4, 5, 1, 16, 4, 7 };
+    impl im(std::begin(input), std::end(input));
+    assert(im.query_offset(0, 3) == 1);
+    assert(im.query_offset(0, 6) == 3);
+    assert(im.query_offset(3, 8) == 6);
+    assert(im.query_offset(0, 10) == 6);
+
+    im.update(6, 20);
+    assert(im.query_offset(3, 8) == 3);
+    im.update(0, 1);
+    assert(im.query_offset(0, 10) == 0);
+    im.push_back(0);
+    assert(im.query_offset(0, 11) == 10);
+    assert(im.query_offset(0, 10) == 0);
+
+    // Outgrowing 16 leaves doubles the tree.
+    const size_t bytes = im.bytes_used();
+    while (im.n() <= 16) {
+      im.push_back(0);
+    }
+    assert(im.bytes_used() >= bytes + 16 * sizeof(difference_type));
+  }
+
+  {
+    // Ties go to the leftmost minimum.
+    impl im;
+    for (int i = 0; i < 6; ++i) {
+      im.push_back(1);
+    }
+    assert(im.query_offset(0, 6) == 0);
+    assert(im.query_offset(2, 6) == 2);
+  }
+
+  {
+    // Grow an array from nothing, mixing in updates, and check it
+    // against brute force as it goes.
+    impl im;
+    for (size_t i = 0; i < 20000; ++i) {
+      im.push_back(std::rand() % 1000);
+      if (i % 3 == 0) {
+        im.update(std::rand() % im.n(), std::rand() % 1000);
+      }
+      check(im, 4, im.n());
+    }
+
+    std::vector<std::pair<difference_type, difference_type> > queries;
+    for (size_t i = 0; i < 10000; ++i) {
+      const difference_type u = std::rand() % im.n();
+      queries.push_back(std::make_pair(u, u + 1 + std::rand() % (im.n() - u)));
+    }
+    std::vector<difference_type> answers;
+    im.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+    assert(answers.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      assert(answers[i] == im.query_offset(queries[i].first, queries[i].second));
+    }
+  }
+
+  {
+    std::vector<int> input(1000000);
+    for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+      *it = std::rand() % 1000;
+    }
+    impl im(input.begin(), input.end());
+    check(im, 100000, 1000);
+    for (size_t i = 0; i < 100000; ++i) {
+      im.update(std::rand() % im.n(), std::rand() % 1000);
+    }
+    check(im, 100000, 1000);
+  }
+
+  return 0;
+}
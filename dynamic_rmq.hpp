@@ -0,0 +1,232 @@
+/**
+ * Implements an <O(n), O(log n)> RMQ solution over an array that can
+ * change between queries, with O(log n) point updates and appends.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "rmq.hpp"
+
+/**
+ * The other implementations are static, they keep iterators into an
+ * array they never see change.  dynamic_rmq owns its values instead, so
+ * it can keep its tree in step with them, and queries take iterators
+ * (or offsets) into its own copy.  Like std::vector's, those iterators
+ * are invalidated by push_back.
+ *
+ * The tree is a bottom-up segment tree laid out in one array: node k's
+ * children are nodes 2k and 2k+1, and the leaves, which would be nodes
+ * capacity() through 2 * capacity() - 1, are left implicit since leaf
+ * capacity() + i is just offset i.  Queries and updates walk straight up
+ * from the leaves without recursion, touching O(log n) nodes each, and
+ * the nodes near the root that every walk shares stay in cache.
+ *
+ * Ties go to the leftmost minimum.
+ */
+template<
+  typename value_type,
+  typename difference_type=std::ptrdiff_t,
+  typename index_type=difference_type
+  >
+class dynamic_rmq {
+public:
+  typedef typename std::vector<value_type>::const_iterator iterator_type;
+
+  static const size_t chunk_size = rmq_chunk_size;
+
+private:
+  /**
+   * The values, in order.
+   */
+  std::vector<value_type> _values;
+
+  /**
+   * _tree[k] for 0 < k < capacity() is the offset of the minimum value
+   * among the leaves under node k.  Leaves past the end of _values stand
+   * for missing values, which lose to any real one, and a node with only
+   * missing leaves under it holds one of their offsets.  _tree[0] is
+   * unused.
+   *
+   * Offsets are stored as index_type, which can be narrower than
+   * difference_type to save space as long as it can hold capacity().
+   */
+  std::vector<index_type> _tree;
+
+  size_t capacity() const { return _tree.size(); }
+
+  /**
+   * The offset held by node k, which may be an implicit leaf.
+   */
+  difference_type node(size_t k) const {
+    return k < capacity() ? difference_type(_tree[k]) : difference_type(k - capacity());
+  }
+
+  /**
+   * The offset of the lesser of the values at offsets x and y, counting
+   * missing values as greater than everything and preferring the
+   * leftmost on ties.
+   */
+  difference_type better(difference_type x, difference_type y) const {
+    const difference_type size = _values.size();
+    if (y >= size) {
+      return x;
+    } else if (x >= size) {
+      return y;
+    } else if (_values[y] < _values[x]) {
+      return y;
+    } else if (_values[x] < _values[y]) {
+      return x;
+    } else {
+      return std::min(x, y);
+    }
+  }
+
+  /**
+   * Recomputes node k from its children.
+   */
+  void pull(size_t k) {
+    _tree[k] = better(node(2 * k), node(2 * k + 1));
+  }
+
+  /**
+   * Lays the tree out again with room for at least size leaves, and
+   * recomputes every node in O(capacity()).
+   */
+  void rebuild(size_t size) {
+    size_t leaves = 1;
+    while (leaves < size) {
+      leaves *= 2;
+    }
+    _tree.assign(leaves, 0);
+    for (size_t k = leaves - 1; k > 0; --k) {
+      pull(k);
+    }
+  }
+
+public:
+  /**
+   * An empty array, to fill in with push_back.
+   */
+  dynamic_rmq()
+  {
+    rebuild(0);
+  }
+
+  /**
+   * Preprocess a copy of the array [b,e) for RMQ queries.
+   */
+  template<typename InputIterator>
+  dynamic_rmq(InputIterator b, InputIterator e)
+    : _values(b, e)
+  {
+    rebuild(_values.size());
+  }
+
+  iterator_type begin() const { return _values.begin(); }
+
+  iterator_type end() const { return _values.end(); }
+
+  /**
+   * Problem size.
+   */
+  difference_type n() const { return _values.size(); }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("values", vector_bytes(_values));
+    usage.add("tree", vector_bytes(_tree));
+    return usage;
+  }
+
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * Sets the value at offset i, in O(log n).
+   *
+   * Preconditions:
+   *  0 <= i < n()
+   */
+  void update(difference_type i, const value_type &value) {
+    _values[i] = value;
+    for (size_t k = (capacity() + i) / 2; k > 0; k /= 2) {
+      pull(k);
+    }
+  }
+
+  /**
+   * Appends value to the array, in amortized O(log n).  When the tree is
+   * full, we double its capacity and rebuild it.
+   */
+  void push_back(const value_type &value) {
+    _values.push_back(value);
+    if (_values.size() > capacity()) {
+      rebuild(_values.size());
+    } else {
+      update(_values.size() - 1, value);
+    }
+  }
+
+  /**
+   * Queries for the index of the minimum value between u and v, which
+   * should be iterators from begin() and end().
+   *
+   * Preconditions:
+   *  begin() <= u < v <= end()
+   */
+  difference_type query(iterator_type u, iterator_type v) const {
+    return query_offset(u - begin(), v - begin());
+  }
+
+  /**
+   * Same query but using integer offsets from begin() rather than
+   * iterators.
+   *
+   * Preconditions:
+   *  0 <= u < v <= n().
+   */
+  difference_type query_offset(difference_type uo, difference_type vo) const {
+    // Walk up from the leaves on either side of the range, taking in the
+    // nodes that hang just inside it at each level.
+    difference_type best = uo;
+    for (size_t l = capacity() + uo, r = capacity() + vo; l < r; l /= 2, r /= 2) {
+      if (l & 1) {
+        best = better(best, node(l++));
+      }
+      if (r & 1) {
+        best = better(best, node(--r));
+      }
+    }
+    return best;
+  }
+
+  /**
+   * Answers the queries in [first, last), which should be a range of
+   * (uo, vo) pairs of offsets like those passed to query_offset, and
+   * writes the answers to out, in order.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    return query_batch_in_chunks<difference_type>(*this, first, last, out);
+  }
+
+  /**
+   * Answers count (at most chunk_size) queries, the ith of which is
+   * query_offset(uos[i], vos[i]), writing the ith answer to out[i].
+   */
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = query_offset(uos[i], vos[i]);
+    }
+  }
+};
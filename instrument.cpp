@@ -0,0 +1,82 @@
+#include <assert.h>
+
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "instrument.hpp"
+#include "opt_rmq.hpp"
+#include "pm_rmq.hpp"
+
+#ifndef RMQ_INSTRUMENT
+#error "this test needs RMQ_INSTRUMENT"
+#endif
+
+typedef std::vector<int>::const_iterator iterator_type;
+typedef std::vector<int>::difference_type difference_type;
+
+uint64_t counter(const instrument::snapshot &s, const char *name) {
+  auto it = s.counters.find(name);
+  return it == s.counters.end() ? 0 : it->second;
+}
+
+int main(int argc, const char *argv[]) {
+  std::vector<int> input(100000);
+  for (size_t i = 1; i < input.size(); ++i) {
+    input[i] = input[i - 1] + (std::rand() % 2 ? 1 : -1);
+  }
+
+  {
+    // One query down each of pm_rmq's paths, and then a batch of them.
+    const pm_rmq<iterator_type> pm(input.begin(), input.end());
+    instrument::snapshot s = instrument::take_snapshot();
+    assert(counter(s, "pm_rmq.builds") == 1);
+    assert(counter(s, "sparse_rmq.builds") == 1);
+    assert(s.counters.count("pm_rmq.build.block_scan_ns") == 1);
+    assert(s.counters.count("pm_rmq.build.super_rmq_ns") == 1);
+
+    instrument::reset();
+    pm.query_offset(0, 10);
+    pm.query_offset(10, 40);
+    pm.query_offset(0, 1000);
+    s = instrument::take_snapshot();
+    assert(counter(s, "pm_rmq.builds") == 0);
+    assert(counter(s, "pm_rmq.query.same_block") == 1);
+    assert(counter(s, "pm_rmq.query.adjacent_blocks") == 1);
+    assert(counter(s, "pm_rmq.query.super_array") == 1);
+    const std::vector<uint64_t> &lengths = s.histograms.at("pm_rmq.query_length");
+    assert(lengths.size() == instrument::histogram_buckets);
+    assert(lengths[3] == 1 && lengths[4] == 1 && lengths[9] == 1);
+
+    const std::vector<std::pair<difference_type, difference_type> > queries =
+      {{0, 10}, {10, 40}, {0, 1000}, {5, 6}};
+    std::vector<difference_type> answers;
+    pm.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+    s = instrument::take_snapshot();
+    assert(counter(s, "pm_rmq.query.same_block") == 3);
+    assert(counter(s, "pm_rmq.query.adjacent_blocks") == 2);
+    assert(counter(s, "pm_rmq.query.super_array") == 2);
+  }
+
+  {
+    // opt_rmq times each phase, and its long queries go through its
+    // pm_rmq.
+    instrument::reset();
+    const opt_rmq<iterator_type> opt(input.begin(), input.end());
+    instrument::snapshot s = instrument::take_snapshot();
+    assert(counter(s, "opt_rmq.builds") == 1);
+    assert(counter(s, "pm_rmq.builds") == 1);
+    assert(counter(s, "opt_rmq.build.cartesian_tree_ns") > 0);
+    assert(counter(s, "opt_rmq.build.euler_tour_ns") > 0);
+    assert(counter(s, "opt_rmq.build.level_rmq_ns") > 0);
+
+    opt.query_offset(0, 5);
+    opt.query_offset(0, 50000);
+    s = instrument::take_snapshot();
+    assert(counter(s, "opt_rmq.query.scan") == 1);
+    assert(counter(s, "opt_rmq.query.lca") == 1);
+    assert(counter(s, "pm_rmq.query.super_array") == 1);
+  }
+  return 0;
+}
@@ -0,0 +1,217 @@
+/**
+ * Opt-in counters, histograms and timers for the implementations' query
+ * paths and build phases, which compile to nothing unless RMQ_INSTRUMENT
+ * is defined.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * The implementations record through the macros at the bottom, under
+ * names like "pm_rmq.query.same_block".  A name is shared by every
+ * instance of an implementation (and every instantiation of its
+ * template), so the numbers are process-wide totals that a metrics
+ * exporter can poll with instrument::take_snapshot().
+ *
+ * Recording is a relaxed atomic add, so instrumented implementations can
+ * still be queried from many threads at once, at the price of contended
+ * cache lines when they are, which is why it's off by default.  The
+ * snapshot API is always there, and just comes back empty when nothing
+ * was compiled in.
+ */
+namespace instrument {
+
+  /**
+   * Histograms have a bucket per power of two: bucket k counts values in
+   * [2^k, 2^(k+1)), and bucket 0 also counts 0.
+   */
+  const size_t histogram_buckets = 64;
+
+  /**
+   * Everything recorded so far, by name.  Timers are counters of
+   * nanoseconds, and their names end in "_ns".
+   */
+  struct snapshot {
+    std::map<std::string, uint64_t> counters;
+    std::map<std::string, std::vector<uint64_t> > histograms;
+  };
+
+  class counter {
+    std::atomic<uint64_t> _value;
+
+  public:
+    counter() : _value(0) {}
+
+    void add(uint64_t x) { _value.fetch_add(x, std::memory_order_relaxed); }
+
+    uint64_t value() const { return _value.load(std::memory_order_relaxed); }
+
+    void reset() { _value.store(0, std::memory_order_relaxed); }
+  };
+
+  class histogram {
+    std::array<std::atomic<uint64_t>, histogram_buckets> _buckets;
+
+  public:
+    histogram() { reset(); }
+
+    void record(uint64_t x) {
+      const size_t bucket = x ? size_t(63 - __builtin_clzll(x)) : 0;
+      _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<uint64_t> buckets() const {
+      std::vector<uint64_t> counts;
+      for (const std::atomic<uint64_t> &b : _buckets) {
+        counts.push_back(b.load(std::memory_order_relaxed));
+      }
+      return counts;
+    }
+
+    void reset() {
+      for (std::atomic<uint64_t> &b : _buckets) {
+        b.store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  /**
+   * Owns the counters and histograms.  Looking one up by name takes a
+   * lock, so the macros do it once per call site and keep a reference;
+   * entries are never removed, so those stay good.
+   */
+  class registry {
+    std::mutex _mutex;
+    std::map<std::string, std::unique_ptr<counter> > _counters;
+    std::map<std::string, std::unique_ptr<histogram> > _histograms;
+
+  public:
+    counter &get_counter(const std::string &name) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::unique_ptr<counter> &c = _counters[name];
+      if (!c) {
+        c.reset(new counter());
+      }
+      return *c;
+    }
+
+    histogram &get_histogram(const std::string &name) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::unique_ptr<histogram> &h = _histograms[name];
+      if (!h) {
+        h.reset(new histogram());
+      }
+      return *h;
+    }
+
+    snapshot take_snapshot() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      snapshot s;
+      for (const auto &c : _counters) {
+        s.counters[c.first] = c.second->value();
+      }
+      for (const auto &h : _histograms) {
+        s.histograms[h.first] = h.second->buckets();
+      }
+      return s;
+    }
+
+    /**
+     * Zeroes everything, keeping the names.
+     */
+    void reset() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (const auto &c : _counters) {
+        c.second->reset();
+      }
+      for (const auto &h : _histograms) {
+        h.second->reset();
+      }
+    }
+  };
+
+  inline registry &global() {
+    static registry r;
+    return r;
+  }
+
+  inline snapshot take_snapshot() { return global().take_snapshot(); }
+
+  inline void reset() { global().reset(); }
+
+  /**
+   * Adds the nanoseconds from its construction to its destruction to a
+   * counter.
+   */
+  class scoped_timer {
+    counter &_ns;
+    const std::chrono::steady_clock::time_point _start;
+
+  public:
+    explicit scoped_timer(counter &ns)
+      : _ns(ns),
+        _start(std::chrono::steady_clock::now())
+    {}
+
+    scoped_timer(const scoped_timer &) = delete;
+    scoped_timer &operator=(const scoped_timer &) = delete;
+
+    ~scoped_timer() {
+      _ns.add(uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - _start).count()));
+    }
+  };
+
+}
+
+#define RMQ_INSTRUMENT_CAT2(a, b) a##b
+#define RMQ_INSTRUMENT_CAT(a, b) RMQ_INSTRUMENT_CAT2(a, b)
+
+#ifdef RMQ_INSTRUMENT
+
+/**
+ * Adds one to the counter name.
+ */
+#define RMQ_COUNT(name) do {                                            \
+    static ::instrument::counter &rmq_counter =                         \
+      ::instrument::global().get_counter(name);                         \
+    rmq_counter.add(1);                                                 \
+  } while (0)
+
+/**
+ * Records value in the histogram name.
+ */
+#define RMQ_RECORD(name, value) do {                                    \
+    static ::instrument::histogram &rmq_histogram =                     \
+      ::instrument::global().get_histogram(name);                       \
+    rmq_histogram.record(uint64_t(value));                              \
+  } while (0)
+
+/**
+ * Times the rest of the enclosing scope into the counter name, which
+ * should end in "_ns".
+ */
+#define RMQ_TIME(name)                                                  \
+  static ::instrument::counter &RMQ_INSTRUMENT_CAT(rmq_timer_ns_, __LINE__) = \
+    ::instrument::global().get_counter(name);                           \
+  ::instrument::scoped_timer RMQ_INSTRUMENT_CAT(rmq_timer_, __LINE__)(  \
+    RMQ_INSTRUMENT_CAT(rmq_timer_ns_, __LINE__))
+
+#else
+
+#define RMQ_COUNT(name) do {} while (0)
+#define RMQ_RECORD(name, value) do {} while (0)
+#define RMQ_TIME(name) do {} while (0)
+
+#endif
@@ -1,11 +1,67 @@
 #include <assert.h>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "tree.hpp"
+#include "tree_test.hpp"
 #include "lca.hpp"
 #include "pm_rmq.hpp"
 
+/**
+ * Checks flat_lca, built from a random parent array of n nodes and from
+ * the same tree as CSR, against lca on the same tree as tree objects.
+ */
+void flat_test(size_t n) {
+  const std::vector<ssize_t> parents = tree_test::random_parents(n);
+  const tree<int> root = tree_test::from_parents(parents);
+  const ::lca<int, pm_rmq<std::vector<ssize_t>::const_iterator>> expected(root);
+
+  std::vector<const tree<int> *> nodes(n);
+  std::vector<const tree<int> *> stack(1, &root);
+  std::vector<uint32_t> offsets(1, 0);
+  std::vector<uint32_t> child_list;
+  while (!stack.empty()) {
+    const tree<int> *node = stack.back();
+    stack.pop_back();
+    nodes[node->id()] = node;
+    for (const tree<int> &c : node->children()) {
+      stack.push_back(&c);
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    for (const tree<int> &c : nodes[i]->children()) {
+      child_list.push_back(uint32_t(c.id()));
+    }
+    offsets.push_back(uint32_t(child_list.size()));
+  }
+
+  typedef pm_rmq<std::vector<int32_t>::const_iterator, int32_t, ssize_t, uint32_t> level_rmq;
+  const flat_lca<level_rmq, uint32_t, int32_t> from_parents(parents.begin(), parents.end());
+  const flat_lca<level_rmq, uint32_t, int32_t> from_csr(offsets.begin(), offsets.end(),
+                                                        child_list.begin());
+  std::vector<std::pair<uint32_t, uint32_t> > queries;
+  for (size_t i = 0; i < 10000; ++i) {
+    const uint32_t u = uint32_t(size_t(std::rand()) % n);
+    const uint32_t v = uint32_t(size_t(std::rand()) % n);
+    const uint32_t w = uint32_t(expected.query(*nodes[u], *nodes[v]).id());
+    assert(from_parents.query(u, v) == w);
+    assert(from_csr.query(u, v) == w);
+    queries.push_back(std::make_pair(u, v));
+  }
+  std::vector<uint32_t> answers;
+  from_parents.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+  assert(answers.size() == queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    assert(answers[i] == from_csr.query(queries[i].first, queries[i].second));
+  }
+  assert(from_parents.bytes_used() > 0);
+}
+
 int main(int argc, const char *argv[]) {
   using std::string;
   std::vector<tree<string> > a_children;
@@ -30,7 +86,7 @@ int main(int argc, const char *argv[]) {
   lca<string, pm_rmq<std::vector<ssize_t>::const_iterator>> lca(input);
 
 #define LCA_TEST(u, v, expect) do {                                     \
-    string ret = lca.query(u, v);                                       \
+    string ret = lca.query(u, v).id();                                  \
     if (expect != ret) {                                                \
       std::cout << "expected LCA(" << u.id() << ", " << v.id() << ") = " << expect << std::endl; \
       std::cout << "got " << ret << std::endl;                          \
@@ -45,5 +101,54 @@ int main(int argc, const char *argv[]) {
 
 #undef LCA_TEST
 
+  {
+    const tree<string> *b = &input.children()[0];
+    const tree<string> *f = &input.children()[1];
+    std::vector<std::pair<const tree<string> *, const tree<string> *> > queries;
+    queries.push_back(std::make_pair(&input, &input));
+    queries.push_back(std::make_pair(b, f));
+    queries.push_back(std::make_pair(&b->children()[0], &b->children()[2]));
+    queries.push_back(std::make_pair(&f->children()[0].children()[0], &f->children()[1]));
+    std::vector<const tree<string> *> answers;
+    lca.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+    assert(answers.size() == 4);
+    assert(answers[0] == &input);
+    assert(answers[1] == &input);
+    assert(answers[2] == b);
+    assert(answers[3] == f);
+  }
+
+  {
+    // A path deep enough that a recursive Euler tour would be in danger
+    // of overflowing the stack.
+    const int depth = 100000;
+    tree<int> path = tree_test::path(depth);
+    ::lca<int, pm_rmq<std::vector<ssize_t>::const_iterator>> path_lca(path);
+
+    const std::vector<const tree<int> *> nodes = tree_test::path_nodes(path);
+    const tree<int> *deepest = nodes.back();
+    const tree<int> *middle = nodes[depth / 2];
+    assert(&path_lca.query(*deepest, path) == &path);
+    assert(&path_lca.query(*deepest, *middle) == middle);
+    assert(&path_lca.query(*deepest, *deepest) == deepest);
+  }
+
+  flat_test(1);
+  flat_test(100000);
+
+  {
+    // A path whose root isn't node 0, and is marked as its own parent.
+    std::vector<uint32_t> parents;
+    const uint32_t depth = 100000;
+    for (uint32_t i = 0; i < depth; ++i) {
+      parents.push_back(i + 1 < depth ? i + 1 : i);
+    }
+    const flat_lca<pm_rmq<std::vector<ssize_t>::const_iterator>, uint32_t> path_lca(parents.begin(),
+                                                                                  parents.end());
+    assert(path_lca.query(0, depth - 1) == depth - 1);
+    assert(path_lca.query(0, depth / 2) == depth / 2);
+    assert(path_lca.query(0, 0) == 0);
+  }
+
   return 0;
 }
@@ -1,17 +1,24 @@
 /**
  * Solves the LCA problem by running the ±1 RMQ solution (or any RMQ
- * implementation, actually) on the Euler tour of the tree.
+ * implementation, actually) on the Euler tour of the tree, given either
+ * as tree objects or as flat arrays of node ids.
  */
 
 #include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <memory>
+#include <tuple>
+#include <utility>
 #include <vector>
 
+#include "rmq.hpp"
 #include "tree.hpp"
 
 template<
   typename value_type,
-  typename rmq_impl
+  typename rmq_impl,
+  typename level_type=ssize_t
   >
 class lca {
 
@@ -21,64 +28,127 @@ class lca {
   const tree<value_type> &_input;
 
   /**
-   * The Euler tour of the input.
+   * The Euler tour of the input, as pointers to the nodes rather than
+   * copies of their ids.
    */
-  std::vector<value_type> _euler;
+  std::vector<const tree<value_type> *> _euler;
 
   /**
    * A vector of the same length as the Euler tour, stores the level of
-   * the node from which the ith element of the Euler tour came.
+   * the node from which the ith element of the Euler tour came.  rmq_impl
+   * must be an RMQ implementation over
+   * std::vector<level_type>::const_iterator, and level_type can be
+   * narrower than ssize_t to save space as long as it can hold the depth
+   * of the tree.
    */
-  std::vector<ssize_t> _level;
+  std::vector<level_type> _level;
+
+  /**
+   * Offsets into the Euler tour (and _level).
+   */
+  typedef typename std::vector<level_type>::difference_type euler_index_type;
 
   /**
    * The ±1 RMQ data structure for the _level array.
    */
   std::unique_ptr<rmq_impl> _rmq;
 
-  template<
-    typename OutputIterator1,
-    typename OutputIterator2
-    >
-  void preprocess(const tree<value_type> &t,
-                  ssize_t level,
-                  OutputIterator1 eulerit,
-                  OutputIterator2 levelit) {
+  /**
+   * Counts the nodes in t, with an explicit stack rather than recursion.
+   */
+  static size_t count_nodes(const tree<value_type> &t) {
+    size_t count = 0;
+    std::vector<const tree<value_type> *> stack(1, &t);
+    while (!stack.empty()) {
+      const tree<value_type> *node = stack.back();
+      stack.pop_back();
+      ++count;
+      for (const tree<value_type> &c : node->children()) {
+        stack.push_back(&c);
+      }
+    }
+    return count;
+  }
+
+  void preprocess() {
+    // The Euler tour of a tree with k nodes has exactly 2k-1 entries, so
+    // we can size everything up front.
+    const size_t nodes = count_nodes(_input);
+    _euler.resize(2 * nodes - 1);
+    _level.resize(2 * nodes - 1);
+
     // Constructs an Euler tour by running a DFS on the tree, emitting the
     // root of each subtree upon arrival and also upon completion of the
-    // search of each of its children.
-    auto val = t.id();
-    *eulerit++ = val;
-    *levelit++ = level;
+    // search of each of its children.  The DFS uses an explicit stack of
+    // nodes and the index of the next child to visit, so that deep trees
+    // (such as the Cartesian trees of sorted inputs) don't overflow the
+    // call stack.  The level of a node is its depth on the stack.
+    std::vector<std::pair<const tree<value_type> *, size_t> > stack;
+    size_t pos = 0;
+    auto emit = [this, &stack, &pos](const tree<value_type> &t) {
+      _euler[pos] = &t;
+      _level[pos] = level_type(stack.size() - 1);
+      ++pos;
+    };
 
     // In the paper, we use a "representative array" R, which maps node
     // ids to an index in the Euler tour.  Since our node ids may not be
     // consecutive integers, in order to get O(1) access to the
     // representative for a node, we must store it in the tree node
     // itself.
-    const_cast<tree<value_type> &>(t).set_repr(_level.end() - 1 - _level.begin());
-
-    std::for_each(t.children().begin(), t.children().end(),
-                  [this, val, level, &eulerit, &levelit](const tree<value_type> &c) {
-                    preprocess(c, level + 1, eulerit, levelit);
-                    *eulerit++ = val;
-                    *levelit++ = level;
-                  });
-  }
+    auto arrive = [this, &stack, &pos, &emit](const tree<value_type> &t) {
+      stack.push_back(std::make_pair(&t, size_t(0)));
+      const_cast<tree<value_type> &>(t).set_repr(pos);
+      emit(t);
+    };
+
+    arrive(_input);
+    while (!stack.empty()) {
+      const tree<value_type> &t = *stack.back().first;
+      const size_t next_child = stack.back().second;
+      if (next_child < t.children().size()) {
+        ++stack.back().second;
+        arrive(t.children()[next_child]);
+      } else {
+        stack.pop_back();
+        if (!stack.empty()) {
+          emit(*stack.back().first);
+        }
+      }
+    }
 
-  void preprocess() {
-    preprocess(_input, 0, std::back_inserter(_euler), std::back_inserter(_level));
     _rmq.reset(new rmq_impl(_level.begin(), _level.end()));
   }
 
 public:
+  /**
+   * Preprocesses t, setting its nodes' repr()s, so t can't be shared
+   * with another lca being built at the same time.  Queries only read,
+   * like the RMQ implementations'.
+   */
   lca(const tree<value_type> &t)
     : _input(t)
   {
     preprocess();
   }
 
-  value_type query(const tree<value_type> &u, const tree<value_type> &v) const {
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("euler_tour", vector_bytes(_euler));
+    usage.add("levels", vector_bytes(_level));
+    usage.add("rmq", _rmq->memory_usage());
+    return usage;
+  }
+
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * Returns the lowest common ancestor of u and v (the node itself, use
+   * id() for its id).
+   */
+  const tree<value_type> &query(const tree<value_type> &u, const tree<value_type> &v) const {
     // After preprocessing, all nodes in the tree should have their repr()
     // initialized.  We use that to find the indexes on which to run the
     // RMQ algorithm.
@@ -92,8 +162,242 @@ public:
                 ? _rmq->query(_level.begin() + ui, _level.begin() + vi + 1)
                 : _rmq->query(_level.begin() + vi, _level.begin() + ui + 1));
 
-    // Future work: return the node itself, rather than the node's id?
-    return _euler[idx];
+    return *_euler[idx];
+  }
+
+  /**
+   * Answers a batch of queries.  [first, last) should be a range of
+   * pairs of pointers to nodes, and pointers to the answers (the same
+   * nodes query returns) are written to out, in order.
+   *
+   * The RMQ queries are run through rmq_impl::query_chunk so that their
+   * misses overlap, and the Euler tour entries are prefetched before
+   * being read.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    const size_t chunk_size = rmq_impl::chunk_size;
+    euler_index_type uis[chunk_size];
+    euler_index_type vis[chunk_size];
+    euler_index_type idxs[chunk_size];
+    while (first != last) {
+      size_t count = 0;
+      for (; count < chunk_size && first != last; ++count, ++first) {
+        const auto ui = std::get<0>(*first)->repr();
+        const auto vi = std::get<1>(*first)->repr();
+        uis[count] = std::min(ui, vi);
+        vis[count] = std::max(ui, vi) + 1;
+      }
+      _rmq->query_chunk(uis, vis, count, idxs);
+      for (size_t i = 0; i < count; ++i) {
+        rmq_prefetch(&_euler[idxs[i]]);
+      }
+      for (size_t i = 0; i < count; ++i) {
+        *out++ = _euler[idxs[i]];
+      }
+    }
+    return out;
   }
 };
 
+/**
+ * The same, for trees kept as flat arrays rather than tree objects: the
+ * nodes are ids 0 through n - 1, given either as each node's parent or
+ * as CSR adjacency (an offsets array and a child list), and queries take
+ * and return ids.
+ *
+ * The Euler tour stores ids, and each node's representative (the offset
+ * of its first appearance in the tour) is kept in an array indexed by
+ * id, so nothing is written to the input.  node_type has to be able to
+ * hold those offsets, which go up to 2n - 2, and level_type the depth of
+ * the tree, as for lca.
+ */
+template<
+  typename rmq_impl,
+  typename node_type=ssize_t,
+  typename level_type=ssize_t
+  >
+class flat_lca {
+
+  /**
+   * The Euler tour of the input, as node ids.
+   */
+  std::vector<node_type> _euler;
+
+  /**
+   * The level of each node in the Euler tour, as for lca.
+   */
+  std::vector<level_type> _level;
+
+  /**
+   * The offset of each node's first appearance in the Euler tour, by
+   * id.  This is the paper's representative array R.
+   */
+  std::vector<node_type> _repr;
+
+  typedef typename std::vector<level_type>::difference_type euler_index_type;
+
+  std::unique_ptr<rmq_impl> _rmq;
+
+  /**
+   * Constructs the Euler tour of the n-node tree rooted at root, where
+   * node u's children are children[offsets[u]] up to (but not including)
+   * children[offsets[u + 1]], with an explicit stack of nodes and the
+   * offset of the next child to visit, as lca does.
+   */
+  template<typename OffsetIterator, typename ChildIterator>
+  void preprocess(node_type root, size_t n, OffsetIterator offsets, ChildIterator children) {
+    assert(n > 0);
+    _euler.resize(2 * n - 1);
+    _level.resize(2 * n - 1);
+    _repr.resize(n);
+
+    std::vector<std::pair<node_type, size_t> > stack;
+    size_t pos = 0;
+    auto emit = [this, &stack, &pos](node_type u) {
+      _euler[pos] = u;
+      _level[pos] = level_type(stack.size() - 1);
+      ++pos;
+    };
+    auto arrive = [this, &stack, &pos, &emit, offsets](node_type u) {
+      stack.push_back(std::make_pair(u, size_t(offsets[u])));
+      _repr[u] = node_type(pos);
+      emit(u);
+    };
+
+    arrive(root);
+    while (!stack.empty()) {
+      const node_type u = stack.back().first;
+      const size_t next_child = stack.back().second;
+      if (next_child < size_t(offsets[u + 1])) {
+        ++stack.back().second;
+        arrive(node_type(children[next_child]));
+      } else {
+        stack.pop_back();
+        if (!stack.empty()) {
+          emit(stack.back().first);
+        }
+      }
+    }
+    // Every node has to be reachable from the root, exactly once.
+    assert(pos == 2 * n - 1);
+
+    _rmq.reset(new rmq_impl(_level.begin(), _level.end()));
+  }
+
+public:
+  /**
+   * Preprocesses the tree of nodes 0 through offsets_end - offsets_begin
+   * - 2 rooted at root, where node u's children are children[offsets[u]]
+   * up to children[offsets[u + 1]], reading the arrays in place.
+   */
+  template<typename OffsetIterator, typename ChildIterator>
+  flat_lca(OffsetIterator offsets_begin, OffsetIterator offsets_end, ChildIterator children,
+           node_type root = 0)
+  {
+    preprocess(root, size_t(offsets_end - offsets_begin - 1), offsets_begin, children);
+  }
+
+  /**
+   * Preprocesses the tree where node u's parent is parents_begin[u].  The
+   * root is the one node that is its own parent, or whose parent isn't a
+   * node at all (like -1).
+   *
+   * The parents are sorted into CSR adjacency with a counting sort, which
+   * is freed once the tour is built.
+   */
+  template<typename ParentIterator>
+  flat_lca(ParentIterator parents_begin, ParentIterator parents_end) {
+    const size_t n = size_t(parents_end - parents_begin);
+    assert(n > 0);
+    auto is_root = [n, parents_begin](size_t u) {
+      const size_t p = size_t(parents_begin[u]);
+      return p >= n || p == u;
+    };
+
+    std::vector<size_t> offsets(n + 1);
+    node_type root = 0;
+    size_t roots = 0;
+    for (size_t u = 0; u < n; ++u) {
+      if (is_root(u)) {
+        root = node_type(u);
+        ++roots;
+      } else {
+        ++offsets[size_t(parents_begin[u]) + 1];
+      }
+    }
+    assert(roots == 1);
+    for (size_t u = 0; u < n; ++u) {
+      offsets[u + 1] += offsets[u];
+    }
+
+    std::vector<node_type> children(n - 1);
+    std::vector<size_t> next(offsets.begin(), offsets.end() - 1);
+    for (size_t u = 0; u < n; ++u) {
+      if (!is_root(u)) {
+        children[next[size_t(parents_begin[u])]++] = node_type(u);
+      }
+    }
+    preprocess(root, n, offsets.begin(), children.begin());
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("euler_tour", vector_bytes(_euler));
+    usage.add("levels", vector_bytes(_level));
+    usage.add("repr", vector_bytes(_repr));
+    usage.add("rmq", _rmq->memory_usage());
+    return usage;
+  }
+
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * Returns the id of the lowest common ancestor of u and v.
+   */
+  node_type query(node_type u, node_type v) const {
+    const euler_index_type ui = _repr[u];
+    const euler_index_type vi = _repr[v];
+    return _euler[_rmq->query_offset(std::min(ui, vi), std::max(ui, vi) + 1)];
+  }
+
+  /**
+   * Answers a batch of queries.  [first, last) should be a range of
+   * pairs of node ids, and the ids of the answers are written to out, in
+   * order.  Works like lca::query_batch.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    const size_t chunk_size = rmq_impl::chunk_size;
+    euler_index_type uis[chunk_size];
+    euler_index_type vis[chunk_size];
+    euler_index_type idxs[chunk_size];
+    while (first != last) {
+      size_t count = 0;
+      for (; count < chunk_size && first != last; ++count, ++first) {
+        const euler_index_type ui = _repr[std::get<0>(*first)];
+        const euler_index_type vi = _repr[std::get<1>(*first)];
+        uis[count] = std::min(ui, vi);
+        vis[count] = std::max(ui, vi) + 1;
+      }
+      _rmq->query_chunk(uis, vis, count, idxs);
+      for (size_t i = 0; i < count; ++i) {
+        rmq_prefetch(&_euler[idxs[i]]);
+      }
+      for (size_t i = 0; i < count; ++i) {
+        *out++ = _euler[idxs[i]];
+      }
+    }
+    return out;
+  }
+};
@@ -0,0 +1,124 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+#include "arena.hpp"
+#include "matrix_rmq.hpp"
+
+typedef std::vector<int>::const_iterator iterator_type;
+typedef std::vector<int>::difference_type difference_type;
+typedef std::tuple<difference_type, difference_type, difference_type, difference_type> rectangle;
+
+/**
+ * Checks impl's answers for queries on a rows by cols matrix against a
+ * scan of each rectangle, that they're in the rectangle and its minimum.
+ * impl is built for queries of up to max_height rows and max_width
+ * columns (0 for any), and half the queries are that small.
+ */
+template<typename impl>
+void matrix_test(difference_type rows, difference_type cols, int range,
+                 difference_type max_height = 0, difference_type max_width = 0) {
+  std::vector<int> input(size_t(rows * cols));
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % range;
+  }
+  const impl im(input.begin(), input.end(), cols, 1, nullptr, max_height, max_width);
+  assert(im.rows() == rows && im.cols() == cols);
+  const difference_type height = max_height > 0 ? std::min(max_height, rows) : rows;
+  const difference_type width = max_width > 0 ? std::min(max_width, cols) : cols;
+
+  std::vector<rectangle> queries;
+  for (size_t i = 0; i < 2000; ++i) {
+    const difference_type r0 = std::rand() % rows;
+    const difference_type c0 = std::rand() % cols;
+    const bool small = i % 2 == 0;
+    const difference_type r1 = r0 + 1 + std::rand() % std::min(small ? height : rows, rows - r0);
+    const difference_type c1 = c0 + 1 + std::rand() % std::min(small ? width : cols, cols - c0);
+    queries.push_back(rectangle(r0, c0, r1, c1));
+  }
+  std::vector<typename impl::position_type> answers;
+  im.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+  assert(answers.size() == queries.size());
+
+  for (size_t i = 0; i < queries.size(); ++i) {
+    difference_type r0, c0, r1, c1;
+    std::tie(r0, c0, r1, c1) = queries[i];
+    int expected = input[size_t(r0 * cols + c0)];
+    for (difference_type r = r0; r < r1; ++r) {
+      for (difference_type c = c0; c < c1; ++c) {
+        expected = std::min(expected, input[size_t(r * cols + c)]);
+      }
+    }
+    const difference_type row = answers[i].first;
+    const difference_type col = answers[i].second;
+    assert(r0 <= row && row < r1 && c0 <= col && col < c1);
+    assert(input[size_t(row * cols + col)] == expected);
+    assert(im.query(r0, c0, r1, c1) == answers[i]);
+    assert(im.min_value(r0, c0, r1, c1) == expected);
+  }
+}
+
+/**
+ * Checks that building with threads, or from an arena, gives the same
+ * answers.
+ */
+void build_test() {
+  const difference_type rows = 300;
+  const difference_type cols = 200;
+  std::vector<int> input(size_t(rows * cols));
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+  std::vector<rectangle> queries;
+  for (size_t i = 0; i < 10000; ++i) {
+    const difference_type r0 = std::rand() % rows;
+    const difference_type c0 = std::rand() % cols;
+    queries.push_back(rectangle(r0, c0, r0 + 1 + std::rand() % (rows - r0),
+                                c0 + 1 + std::rand() % (cols - c0)));
+  }
+
+  typedef matrix_rmq<iterator_type, int, difference_type, uint32_t> impl;
+  const impl serial(input.begin(), input.end(), cols);
+  const impl parallel(input.begin(), input.end(), cols, 4);
+  std::unique_ptr<impl> built;
+  {
+    arena storage(4096);
+    built.reset(new impl(input.begin(), input.end(), cols, 1, &storage));
+    assert(built->bytes_used() == serial.bytes_used());
+    assert(storage.bytes_reserved() >= built->bytes_used());
+  }
+
+  std::vector<impl::position_type> serial_answers;
+  std::vector<impl::position_type> parallel_answers;
+  std::vector<impl::position_type> built_answers;
+  serial.query_batch(queries.begin(), queries.end(), std::back_inserter(serial_answers));
+  parallel.query_batch(queries.begin(), queries.end(), std::back_inserter(parallel_answers));
+  built->query_batch(queries.begin(), queries.end(), std::back_inserter(built_answers));
+  assert(parallel_answers == serial_answers);
+  assert(built_answers == serial_answers);
+}
+
+int main(int argc, const char *argv[]) {
+  typedef matrix_rmq<iterator_type> impl;
+  typedef matrix_rmq<iterator_type, int, difference_type, uint32_t> narrow_impl;
+  matrix_test<impl>(1, 1, 10);
+  matrix_test<impl>(1, 513, 1000);
+  matrix_test<impl>(513, 1, 1000);
+  matrix_test<impl>(37, 53, 4);
+  matrix_test<impl>(64, 64, 1000000);
+  matrix_test<narrow_impl>(100, 300, 1000);
+  matrix_test<narrow_impl>(129, 77, 2);
+  matrix_test<narrow_impl>(200, 150, 1000, 20, 0);
+  matrix_test<narrow_impl>(200, 150, 1000, 0, 9);
+  matrix_test<narrow_impl>(200, 150, 1000, 33, 17);
+  matrix_test<narrow_impl>(100, 80, 1000, 1, 1);
+  matrix_test<narrow_impl>(100, 80, 5, 2, 3);
+  build_test();
+  return 0;
+}
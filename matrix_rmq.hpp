@@ -0,0 +1,413 @@
+/**
+ * Implements RMQ over the rectangles of a matrix, in O(1) queries, by
+ * sparse_rmqs over the rows of a sparse table of row ranges.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "parallel.hpp"
+#include "rmq.hpp"
+#include "sparse_rmq.hpp"
+#include "table.hpp"
+
+/**
+ * The input is a matrix stored row-major in [b,e), cols elements to a
+ * row, and a query is a rectangle of it: rows [r0, r1) and columns
+ * [c0, c1), answered with the (row, column) of its minimum.
+ *
+ * This is sparse_rmq's idea applied to the rows: level d holds, for each
+ * run of 2^d rows starting at row i, the minimum of each column over
+ * those rows, and which row it's in.  Those minima are laid out
+ * row-major like the input, and a sparse_rmq over each level (and one
+ * over the input itself, for level 0) answers for the columns of any of
+ * its rows.  A query of height h covers its rows with the two (possibly
+ * overlapping) runs of 2^lg(h) rows at its top and bottom, asks that
+ * level's sparse_rmq for the columns of each, and takes the lesser
+ * answer: four table entries, like two sparse_rmq queries.
+ *
+ * The levels' sparse_rmqs only build the levels needed for one row, so
+ * the whole thing takes O(rows cols log rows log cols) space, about
+ * lg(rows) + 1 times what sparse_rmqs over each row would.  For large
+ * matrices max_height and max_width can cap the queries' dimensions, the
+ * way sparse_rmq's max_length does, and only the levels they need are
+ * built.
+ *
+ * index_type has to be able to hold rows * cols.  Ties go to any of the
+ * minima.
+ */
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
+  >
+class matrix_rmq {
+public:
+  static const size_t chunk_size = rmq_chunk_size;
+
+  /**
+   * A position in the matrix, as (row, column).
+   */
+  typedef std::pair<difference_type, difference_type> position_type;
+
+private:
+  typedef difference_type level_type;
+
+  /**
+   * The deepest level there can be, for a matrix of at most 2^64 rows.
+   */
+  static const size_t max_depth = 63;
+
+  typedef sparse_rmq<iterator_type, value_type, difference_type, index_type> row_rmq_type;
+  typedef sparse_rmq<const value_type *, value_type, difference_type, index_type> level_rmq_type;
+
+  const iterator_type _begin;
+  const difference_type _rows;
+  const difference_type _cols;
+
+  /**
+   * The input's rows, as level 0.
+   */
+  std::unique_ptr<row_rmq_type> _row_rmq;
+
+  /**
+   * Level d (at _levels[d - 1]) has a row for each of the _rows - 2^d +
+   * 1 runs of 2^d rows, each holding the minima of the run's columns and
+   * the rows they're in, and a sparse_rmq over those minima.
+   */
+  struct level {
+    table<value_type> values;
+    table<index_type> rows;
+    std::unique_ptr<level_rmq_type> rmq;
+  };
+  std::vector<level> _levels;
+
+  /**
+   * The deepest level needed for queries with up to max_height (0 for
+   * any number of) rows.
+   */
+  static level_type max_level(difference_type rows, difference_type max_height) {
+    return rmq_lg(max_height > 0 ? std::min(rows, max_height) : rows);
+  }
+
+  /**
+   * Level d + 1 from level d, or from the input if d is 0, in parallel
+   * over its entries.
+   */
+  void fill_in(level_type d, unsigned threads, arena *storage, difference_type max_width) {
+    const difference_type height = difference_type(1) << d;
+    const difference_type size = (_rows - 2 * height + 1) * _cols;
+    level &next = _levels[d];
+    next.values = table<value_type>(size_t(size), storage);
+    next.rows = table<index_type>(size_t(size), storage);
+
+    value_type *const values = next.values.data();
+    index_type *const rows = next.rows.data();
+    const difference_type below = height * _cols;
+    if (d == 0) {
+      const iterator_type b = _begin;
+      const difference_type cols = _cols;
+      parallel_for(0, size_t(size), threads,
+                   [b, values, rows, below, cols](size_t lo, size_t hi) {
+                     for (size_t i = lo; i < hi; ++i) {
+                       const bool lower = b[i + below] < b[i];
+                       values[i] = b[lower ? i + below : i];
+                       rows[i] = index_type(i / cols + (lower ? 1 : 0));
+                     }
+                   });
+    } else {
+      const level &prev = _levels[d - 1];
+      const value_type *const prev_values = prev.values.data();
+      const index_type *const prev_rows = prev.rows.data();
+      parallel_for(0, size_t(size), threads,
+                   [prev_values, prev_rows, values, rows, below](size_t lo, size_t hi) {
+                     for (size_t i = lo; i < hi; ++i) {
+                       const size_t j = prev_values[i + below] < prev_values[i] ? i + below : i;
+                       values[i] = prev_values[j];
+                       rows[i] = prev_rows[j];
+                     }
+                   });
+    }
+    next.rmq.reset(new level_rmq_type(next.values.cbegin(), next.values.cend(),
+                                      threads, storage, max_width));
+  }
+
+  const value_type &at(const position_type &p) const {
+    return _begin[p.first * _cols + p.second];
+  }
+
+  /**
+   * Checks a query's bounds, and returns the level it's answered from,
+   * unless max_height left that level out, when the depth is tall().
+   */
+  level_type query_depth(difference_type r0, difference_type c0,
+                         difference_type r1, difference_type c1) const {
+    assert(0 <= r0 && r0 < r1 && r1 <= _rows);
+    assert(0 <= c0 && c0 < c1 && c1 <= _cols);
+    return rmq_lg(r1 - r0);
+  }
+
+  bool tall(level_type depth) const {
+    return depth > level_type(_levels.size());
+  }
+
+  /**
+   * The position of the minimum in the 2^depth rows from row r and
+   * columns [c0, c1), from level depth alone.
+   */
+  position_type query_run(level_type depth, difference_type r,
+                          difference_type c0, difference_type c1) const {
+    const difference_type top = r * _cols;
+    if (depth == 0) {
+      return position_type(r, _row_rmq->query_offset(top + c0, top + c1) - top);
+    }
+    const level &l = _levels[depth - 1];
+    const difference_type x = l.rmq->query_offset(top + c0, top + c1);
+    return position_type(l.rows[x], x - top);
+  }
+
+  /**
+   * Answers a query with more rows than two runs of the deepest level
+   * cover, by covering them with as many runs as it takes, from the top
+   * down (the last overlapping the one before), preferring the topmost
+   * run's minimum on ties.
+   */
+  position_type query_tall(difference_type r0, difference_type c0,
+                           difference_type r1, difference_type c1) const {
+    const level_type depth = level_type(_levels.size());
+    const difference_type height = difference_type(1) << depth;
+    position_type best = query_run(depth, r0, c0, c1);
+    for (difference_type r = r0 + height; r < r1; r += height) {
+      const position_type p = query_run(depth, std::min(r, r1 - height), c0, c1);
+      if (at(p) < at(best)) {
+        best = p;
+      }
+    }
+    return best;
+  }
+
+  /**
+   * The lesser of the minima found at offsets x, in the row starting at
+   * top, and y, in the row starting at bottom, of level l, preferring x
+   * on ties.
+   */
+  static position_type combine(const level &l, difference_type x, difference_type top,
+                               difference_type y, difference_type bottom) {
+    return l.values[y] < l.values[x]
+      ? position_type(l.rows[y], y - bottom)
+      : position_type(l.rows[x], x - top);
+  }
+
+public:
+  /**
+   * Preprocess the matrix stored row-major in [b,e), cols elements to a
+   * row, for rectangle queries, using up to threads threads, and taking
+   * all the tables from storage if it's given.
+   *
+   * If max_height or max_width isn't 0, only the levels needed for
+   * queries of up to that many rows or columns are built.  Queries
+   * larger than twice the largest power of two no larger than it, less
+   * one, are still answered, but in time proportional to how many times
+   * over it they are in each dimension.
+   *
+   * Preconditions:
+   *  cols > 0, and e - b a positive multiple of cols
+   */
+  matrix_rmq(iterator_type b, iterator_type e, difference_type cols,
+             unsigned threads = 1, arena *storage = nullptr,
+             difference_type max_height = 0, difference_type max_width = 0)
+    : _begin(b),
+      _rows(cols > 0 ? (e - b) / cols : 0),
+      _cols(cols)
+  {
+    assert(cols > 0 && e - b > 0 && (e - b) % cols == 0);
+    const difference_type width = max_width > 0 ? std::min(max_width, cols) : cols;
+    _row_rmq.reset(new row_rmq_type(b, e, threads, storage, width));
+    _levels.resize(size_t(max_level(_rows, max_height)));
+    for (level_type d = 0; d < level_type(_levels.size()); ++d) {
+      fill_in(d, threads, storage, width);
+    }
+  }
+
+  difference_type rows() const { return _rows; }
+
+  difference_type cols() const { return _cols; }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("row_rmq", _row_rmq->memory_usage());
+    size_t value_bytes = 0;
+    size_t row_bytes = 0;
+    size_t rmq_bytes = 0;
+    for (const level &l : _levels) {
+      value_bytes += l.values.bytes_used();
+      row_bytes += l.rows.bytes_used();
+      rmq_bytes += l.rmq->bytes_used();
+    }
+    usage.add("level_values", value_bytes);
+    usage.add("level_rows", row_bytes);
+    usage.add("level_rmqs", rmq_bytes);
+    return usage;
+  }
+
+  /**
+   * The total of memory_usage().
+   */
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * The position of the minimum value in rows [r0, r1) and columns
+   * [c0, c1).
+   *
+   * Preconditions:
+   *  0 <= r0 < r1 <= rows() and 0 <= c0 < c1 <= cols()
+   */
+  position_type query(difference_type r0, difference_type c0,
+                      difference_type r1, difference_type c1) const {
+    const level_type depth = query_depth(r0, c0, r1, c1);
+    if (tall(depth)) {
+      return query_tall(r0, c0, r1, c1);
+    }
+    const difference_type top = r0 * _cols;
+    if (depth == 0) {
+      return position_type(r0, _row_rmq->query_offset(top + c0, top + c1) - top);
+    }
+
+    const level &l = _levels[depth - 1];
+    const difference_type bottom = (r1 - (difference_type(1) << depth)) * _cols;
+    return combine(l, l.rmq->query_offset(top + c0, top + c1), top,
+                   l.rmq->query_offset(bottom + c0, bottom + c1), bottom);
+  }
+
+  /**
+   * The minimum value in rows [r0, r1) and columns [c0, c1).
+   */
+  const value_type &min_value(difference_type r0, difference_type c0,
+                              difference_type r1, difference_type c1) const {
+    return at(query(r0, c0, r1, c1));
+  }
+
+  /**
+   * Answers the queries in [first, last), which should be a range of
+   * (r0, c0, r1, c1) tuples like those passed to query, by handing them
+   * to query_chunk chunk_size at a time, and writes the positions to
+   * out, in order.
+   */
+  template<typename InputIterator, typename OutputIterator>
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    difference_type r0s[chunk_size];
+    difference_type c0s[chunk_size];
+    difference_type r1s[chunk_size];
+    difference_type c1s[chunk_size];
+    position_type answers[chunk_size];
+    while (first != last) {
+      size_t count = 0;
+      for (; count < chunk_size && first != last; ++count, ++first) {
+        r0s[count] = std::get<0>(*first);
+        c0s[count] = std::get<1>(*first);
+        r1s[count] = std::get<2>(*first);
+        c1s[count] = std::get<3>(*first);
+      }
+      query_chunk(r0s, c0s, r1s, c1s, count, answers);
+      out = std::copy(answers, answers + count, out);
+    }
+    return out;
+  }
+
+  /**
+   * Answers count (at most chunk_size) queries, the ith of which is
+   * query(r0s[i], c0s[i], r1s[i], c1s[i]), writing the ith answer to
+   * out[i].
+   */
+  void query_chunk(const difference_type *r0s, const difference_type *c0s,
+                   const difference_type *r1s, const difference_type *c1s,
+                   size_t count, position_type *out) const {
+    // Sort the queries by level, and hand each level's sparse_rmq all of
+    // its tops' lookups and then all of its bottoms', as one chunk each,
+    // so their misses overlap.  Then prefetch the minima they found, and
+    // only then compare.
+    level_type depths[chunk_size];
+    size_t starts[max_depth + 2] = {};
+    for (size_t i = 0; i < count; ++i) {
+      depths[i] = query_depth(r0s[i], c0s[i], r1s[i], c1s[i]);
+      ++starts[depths[i] + 1];
+    }
+    for (size_t d = 1; d <= max_depth + 1; ++d) {
+      starts[d] += starts[d - 1];
+    }
+    size_t order[chunk_size];
+    for (size_t i = 0; i < count; ++i) {
+      order[starts[depths[i]]++] = i;
+    }
+
+    // xs[j] and ys[j] are the answers for the top and bottom of the jth
+    // query in order.
+    difference_type xs[chunk_size];
+    difference_type ys[chunk_size];
+    difference_type uos[chunk_size];
+    difference_type vos[chunk_size];
+    for (size_t run = 0, run_end; run < count; run = run_end) {
+      const level_type depth = depths[order[run]];
+      for (run_end = run; run_end < count && depths[order[run_end]] == depth; ++run_end) {
+        const size_t i = order[run_end];
+        uos[run_end - run] = r0s[i] * _cols + c0s[i];
+        vos[run_end - run] = r0s[i] * _cols + c1s[i];
+      }
+      if (tall(depth)) {
+        // These take a lookup per run they span, so they're answered
+        // one at a time.
+        for (size_t j = run; j < run_end; ++j) {
+          const size_t i = order[j];
+          out[i] = query_tall(r0s[i], c0s[i], r1s[i], c1s[i]);
+        }
+        continue;
+      }
+      if (depth == 0) {
+        _row_rmq->query_chunk(uos, vos, run_end - run, xs + run);
+        continue;
+      }
+
+      const level &l = _levels[depth - 1];
+      l.rmq->query_chunk(uos, vos, run_end - run, xs + run);
+      for (size_t j = run; j < run_end; ++j) {
+        const size_t i = order[j];
+        const difference_type bottom = (r1s[i] - (difference_type(1) << depth)) * _cols;
+        uos[j - run] = bottom + c0s[i];
+        vos[j - run] = bottom + c1s[i];
+      }
+      l.rmq->query_chunk(uos, vos, run_end - run, ys + run);
+      for (size_t j = run; j < run_end; ++j) {
+        rmq_prefetch(&l.values[xs[j]]);
+        rmq_prefetch(&l.values[ys[j]]);
+        rmq_prefetch(&l.rows[xs[j]]);
+        rmq_prefetch(&l.rows[ys[j]]);
+      }
+    }
+
+    for (size_t j = 0; j < count; ++j) {
+      const size_t i = order[j];
+      const level_type depth = depths[i];
+      const difference_type top = r0s[i] * _cols;
+      if (tall(depth)) {
+        continue;
+      } else if (depth == 0) {
+        out[i] = position_type(r0s[i], xs[j] - top);
+      } else {
+        const difference_type bottom = (r1s[i] - (difference_type(1) << depth)) * _cols;
+        out[i] = combine(_levels[depth - 1], xs[j], top, ys[j], bottom);
+      }
+    }
+  }
+};
@@ -1,4 +1,36 @@
 #include "naive_rmq.hpp"
 #include "rmq_test.hpp"
 
-TEST_IMPL(naive_rmq)
+template<typename iterator_type>
+using fixed_16_rmq = fixed_naive_rmq<iterator_type, 16>;
+
+/**
+ * Checks fixed_naive_rmq against naive_rmq on every range of random
+ * inputs of every size up to max_n.
+ */
+template<size_t max_n>
+void fixed_test() {
+  for (size_t len = 1; len <= max_n; ++len) {
+    std::vector<int> input(len);
+    for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+      *it = std::rand() % 10;
+    }
+    const naive_rmq<std::vector<int>::const_iterator> expected(input.begin(), input.end());
+    const fixed_naive_rmq<std::vector<int>::const_iterator, max_n> found(input.begin(), input.end());
+    for (size_t u = 0; u < len; ++u) {
+      for (size_t v = u + 1; v <= len; ++v) {
+        assert(found.query_offset(u, v) == expected.query_offset(u, v));
+      }
+    }
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  // naive_rmq uses O(n^2) memory, so keep the vector test small.
+  RMQ_TEST_BODY(naive_rmq, 2000);
+  RMQ_NARROW_TEST_BODY(naive_rmq, 2000);
+  rmq_test::test<fixed_16_rmq<int *>>();
+  fixed_test<16>();
+  fixed_test<256>();
+  return 0;
+}
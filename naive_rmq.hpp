@@ -1,73 +1,196 @@
 /**
- * Implements the naive <O(n^2), O(1)> RMQ solution.
+ * Implements the naive <O(n^2), O(1)> RMQ solution, and a version of it
+ * for small inputs whose size is bounded at compile time.
  */
 
+#pragma once
+
 #include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
 #include <iterator>
+#include <type_traits>
 #include <vector>
 
 #include <boost/iterator/counting_iterator.hpp>
 
 #include "rmq.hpp"
+#include "simd.hpp"
+#include "table.hpp"
 
 template<
   typename iterator_type,
   typename value_type=typename std::iterator_traits<iterator_type>::value_type,
-  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
   >
-class naive_rmq : public rmq<iterator_type, value_type, difference_type> {
+class naive_rmq : public rmq<naive_rmq<iterator_type, value_type, difference_type, index_type>,
+                              iterator_type, value_type, difference_type> {
+
+  typedef rmq<naive_rmq, iterator_type, value_type, difference_type> rmq_base;
 
   // Compilers are dumb.
-  using rmq<iterator_type, value_type, difference_type>::begin;
-  using rmq<iterator_type, value_type, difference_type>::end;
-  using rmq<iterator_type, value_type, difference_type>::n;
-  using rmq<iterator_type, value_type, difference_type>::val;
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
 
   /**
-   * 2D array of precomputed answers.
+   * All the precomputed answers, in one table with the levels laid out
+   * back to back: level b holds the answers for the n - b ranges of
+   * length b + 1, starting at level_offset(b).
    *
-   * _arr[b][a] is the index of the minimum value in the range [a, a+b+1].
+   * _arr[level_offset(b) + a] is the index of the minimum value in the
+   * range [a, a+b+1).  Indexes are stored as index_type, which can be
+   * narrower than difference_type to save space as long as it can hold
+   * n().
    */
-  std::vector<std::vector<difference_type>> _arr;
+  table<index_type> _arr;
+
+  size_t level_offset(difference_type b) const {
+    return size_t(b) * size_t(n()) - size_t(b) * size_t(b - 1) / 2;
+  }
 
   /**
    * Dynamic program to compute the answers to every possible query on the
    * input.
    */
-  void fill_in() {
-    // The first level _arr[0] contains the answers to RMQ queries on
-    // intervals of length 1, which must just be the first element in the
-    // interval.
-    std::copy_n(boost::counting_iterator<difference_type>(0), n(),
-                std::back_inserter(_arr[0]));
+  void fill_in(std::false_type) {
+    // The first level contains the answers to RMQ queries on intervals
+    // of length 1, which must just be the first element in the interval.
+    std::copy_n(boost::counting_iterator<index_type>(0), n(), _arr.begin());
 
     // Fill in each consecutive level by choosing the smaller of each
     // neighboring values in the previous level.
-    for (auto it = _arr.begin(); it + 1 < _arr.end(); ++it) {
+    for (difference_type b = 0; b + 1 < n(); ++b) {
       // Zips neighboring indexes of this level together with a functor
       // that chooses the index producing the lesser value, from each pair
       // of indexes.
-      std::transform(it->begin(), it->end() - 1,
-                     it->begin() + 1,
-                     std::back_inserter(*(it + 1)),
-                     [this](const difference_type &x, const difference_type &y) {
+      const auto prev = _arr.begin() + level_offset(b);
+      std::transform(prev, prev + (n() - b - 1),
+                     prev + 1,
+                     _arr.begin() + level_offset(b + 1),
+                     [this](const index_type &x, const index_type &y) {
                        return val(x) < val(y) ? x : y;
                      });
     }
   }
 
+  /**
+   * The same dynamic program for the value and index types that
+   * simd::min_level has vector instructions for, carrying each level's
+   * minimum values alongside its indexes so that neighboring values can
+   * be compared many at a time.
+   */
+  void fill_in(std::true_type) {
+    std::copy_n(boost::counting_iterator<index_type>(0), n(), _arr.begin());
+
+    std::vector<value_type> vals(begin(), end());
+    std::vector<value_type> next_vals(n());
+    for (difference_type b = 0; b + 1 < n(); ++b) {
+      const index_type *prev = _arr.data() + level_offset(b);
+      simd::min_level(vals.data(), vals.data() + 1, prev, prev + 1, n() - b - 1,
+                      next_vals.data(), _arr.data() + level_offset(b + 1));
+      vals.swap(next_vals);
+    }
+  }
+
+public:
+  /**
+   * Preprocess the array [b,e) for RMQ queries, taking the table from
+   * storage if it's given.
+   */
+  naive_rmq(iterator_type b, iterator_type e, arena *storage = nullptr)
+    : rmq_base(b, e),
+      _arr(level_offset(n()), storage)
+  {
+    fill_in(std::integral_constant<
+            bool, simd::vector_min_level<value_type, index_type>::vectorized>());
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("table", _arr.bytes_used());
+    return usage;
+  }
+
+  difference_type query(iterator_type u, iterator_type v) const {
+    return _arr[level_offset(v-u-1) + (u-begin())];
+  }
+};
+
+/**
+ * naive_rmq for inputs of at most max_n elements, with max_n known at
+ * compile time: the answers are offsets of a byte each, in a triangular
+ * table held in the object itself, so that a query on a small range is
+ * one load from memory that's likely already in cache, with no pointer
+ * to chase.  Answers are the same as naive_rmq's.
+ */
+template<
+  typename iterator_type,
+  size_t max_n,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  >
+class fixed_naive_rmq : public rmq<fixed_naive_rmq<iterator_type, max_n, value_type, difference_type>,
+                                    iterator_type, value_type, difference_type> {
+
+  static_assert(max_n > 0 && max_n <= 256, "offsets have to fit in a byte");
+
+  typedef rmq<fixed_naive_rmq, iterator_type, value_type, difference_type> rmq_base;
+
+  // Compilers are dumb.
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+
+  /**
+   * Laid out like naive_rmq's table, for the input's actual size, so a
+   * smaller input uses a prefix of it.
+   */
+  std::array<uint8_t, max_n * (max_n + 1) / 2> _arr;
+
+  size_t level_offset(difference_type b) const {
+    return size_t(b) * size_t(n()) - size_t(b) * size_t(b - 1) / 2;
+  }
+
 public:
-  naive_rmq(iterator_type b, iterator_type e)
-    : rmq<iterator_type, value_type, difference_type>(b, e),
-      _arr(n())
+  /**
+   * Preprocess the array [b,e) for RMQ queries.
+   *
+   * Preconditions:
+   *  e - b <= max_n
+   */
+  fixed_naive_rmq(iterator_type b, iterator_type e)
+    : rmq_base(b, e)
   {
-    std::fill(_arr.begin(), _arr.end(),
-              std::vector<difference_type>());
+    assert(n() <= difference_type(max_n));
+    for (difference_type a = 0; a < n(); ++a) {
+      _arr[a] = uint8_t(a);
+    }
+    for (difference_type level = 0; level + 1 < n(); ++level) {
+      const uint8_t *prev = _arr.data() + level_offset(level);
+      uint8_t *next = _arr.data() + level_offset(level + 1);
+      for (difference_type a = 0; a + level + 1 < n(); ++a) {
+        next[a] = val(prev[a]) < val(prev[a + 1]) ? prev[a] : prev[a + 1];
+      }
+    }
+  }
 
-    fill_in();
+  /**
+   * The table is part of the object rather than allocated, but it's
+   * where all the memory goes.
+   */
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("table", sizeof _arr);
+    return usage;
   }
 
   difference_type query(iterator_type u, iterator_type v) const {
-    return _arr[v-u-1][u-begin()];
+    return _arr[level_offset(v-u-1) + (u-begin())];
   }
 };
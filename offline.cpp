@@ -0,0 +1,107 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "lca.hpp"
+#include "offline.hpp"
+#include "pm_rmq.hpp"
+#include "tree.hpp"
+#include "tree_test.hpp"
+
+typedef std::vector<int>::difference_type difference_type;
+typedef std::pair<difference_type, difference_type> query_type;
+
+/**
+ * Checks offline_rmq's answers, with index_type for its arrays, against
+ * the leftmost minimum of each range found by scanning.
+ */
+template<typename index_type>
+void rmq_test(size_t n, size_t max_len) {
+  std::vector<int> input(n);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 100;
+  }
+  std::vector<query_type> queries;
+  for (size_t i = 0; i < 20000; ++i) {
+    const size_t u = size_t(std::rand()) % n;
+    const size_t v = u + 1 + size_t(std::rand()) % std::min(max_len, n - u);
+    queries.push_back(query_type(difference_type(u), difference_type(v)));
+  }
+
+  std::vector<difference_type> answers;
+  offline_rmq<index_type>(input.begin(), input.end(), queries.begin(), queries.end(),
+                          std::back_inserter(answers));
+  assert(answers.size() == queries.size());
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const difference_type expected =
+      std::min_element(input.begin() + queries[i].first, input.begin() + queries[i].second) -
+      input.begin();
+    assert(answers[i] == expected);
+  }
+
+  std::vector<difference_type> none;
+  offline_rmq(input.begin(), input.end(), queries.end(), queries.end(), std::back_inserter(none));
+  assert(none.empty());
+}
+
+/**
+ * Checks offline_lca against lca on a random tree of n nodes.
+ */
+void lca_test(size_t n) {
+  const tree<int> root = tree_test::from_parents(tree_test::random_parents(n));
+
+  std::vector<const tree<int> *> nodes(1, &root);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    for (const tree<int> &c : nodes[i]->children()) {
+      nodes.push_back(&c);
+    }
+  }
+  assert(nodes.size() == n);
+
+  std::vector<std::pair<const tree<int> *, const tree<int> *> > queries;
+  for (size_t i = 0; i < 20000; ++i) {
+    queries.push_back(std::make_pair(nodes[size_t(std::rand()) % n], nodes[size_t(std::rand()) % n]));
+  }
+  std::vector<const tree<int> *> answers;
+  offline_lca(root, queries.begin(), queries.end(), std::back_inserter(answers));
+
+  const lca<int, pm_rmq<std::vector<ssize_t>::const_iterator>> online(root);
+  std::vector<const tree<int> *> expected;
+  online.query_batch(queries.begin(), queries.end(), std::back_inserter(expected));
+  assert(answers == expected);
+}
+
+int main(int argc, const char *argv[]) {
+  rmq_test<std::ptrdiff_t>(1, 1);
+  rmq_test<std::ptrdiff_t>(100000, 100);
+  rmq_test<uint32_t>(20000, 20000);
+
+  lca_test(1);
+  lca_test(100000);
+
+  {
+    // A path deep enough that a recursive DFS would be in danger of
+    // overflowing the stack.
+    const int depth = 100000;
+    const tree<int> path = tree_test::path(depth);
+    const std::vector<const tree<int> *> nodes = tree_test::path_nodes(path);
+    const tree<int> *deepest = nodes.back();
+    const tree<int> *middle = nodes[depth / 2];
+    std::vector<std::pair<const tree<int> *, const tree<int> *> > queries;
+    queries.push_back(std::make_pair(deepest, &path));
+    queries.push_back(std::make_pair(middle, deepest));
+    queries.push_back(std::make_pair(deepest, deepest));
+    std::vector<const tree<int> *> answers;
+    offline_lca<uint32_t>(path, queries.begin(), queries.end(), std::back_inserter(answers));
+    assert(answers.size() == 3);
+    assert(answers[0] == &path);
+    assert(answers[1] == middle);
+    assert(answers[2] == deepest);
+  }
+  return 0;
+}
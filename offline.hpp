@@ -0,0 +1,217 @@
+/**
+ * Answers batches of RMQ and LCA queries that are all known up front,
+ * without building an index to keep.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace offline {
+
+  /**
+   * The root of x's set in a union-find forest where parent[x] == x for
+   * roots, halving the path on the way.  Sets are only ever linked under
+   * a root that comes later (in the sweep or the DFS), so there's no
+   * need for ranks.
+   */
+  template<typename index_type>
+  index_type find(std::vector<index_type> &parent, index_type x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  /**
+   * Sentinel ending the lists of queries threaded through an array.
+   */
+  template<typename index_type>
+  index_type none() { return index_type(-1); }
+
+}
+
+/**
+ * Answers the RMQ queries in [first, last) on the array [b,e): like
+ * query_batch, the queries are (uo, vo) pairs of offsets, and the offset
+ * of the leftmost minimum of each [uo, vo) is written to out, in order.
+ *
+ * The queries are bucketed by where they end, and then one sweep over
+ * the array keeps a monotonic stack of the positions that are smaller
+ * than everything after them so far, in a union-find forest where each
+ * position popped off the stack points to the one that popped it.  A
+ * query ending at the current position finds its answer as the root of
+ * its start.  That's O(n + q) time, up to the union-find's near-constant
+ * factor, and about three index_types per element of the array and one
+ * per query of temporary space, all freed at the end.
+ *
+ * index_type is what the temporary arrays hold, and can be narrower
+ * than the iterator's difference type to save space as long as it can
+ * hold n and the number of queries.
+ *
+ * Preconditions:
+ *  0 <= uo < vo <= e - b for every query
+ */
+template<
+  typename index_type=std::ptrdiff_t,
+  typename iterator_type,
+  typename ForwardIterator,
+  typename OutputIterator
+  >
+OutputIterator offline_rmq(iterator_type b, iterator_type e,
+                           ForwardIterator first, ForwardIterator last,
+                           OutputIterator out) {
+  typedef typename std::iterator_traits<iterator_type>::difference_type difference_type;
+  const index_type n = index_type(e - b);
+  const index_type q = index_type(std::distance(first, last));
+
+  // Each query's start goes in its answer's place until it's answered,
+  // and the queries ending at vo - 1 are a list starting at
+  // ending[vo - 1] and threaded through next.
+  std::vector<difference_type> answers(q);
+  std::vector<index_type> ending(n, offline::none<index_type>());
+  std::vector<index_type> next(q);
+  index_type j = 0;
+  for (ForwardIterator it = first; it != last; ++it, ++j) {
+    const difference_type uo = std::get<0>(*it);
+    const difference_type vo = std::get<1>(*it);
+    assert(0 <= uo && uo < vo && vo <= difference_type(n));
+    answers[j] = uo;
+    next[j] = ending[vo - 1];
+    ending[vo - 1] = j;
+  }
+
+  std::vector<index_type> parent(n);
+  std::vector<index_type> stack;
+  for (index_type i = 0; i < n; ++i) {
+    // Popping only strictly greater values leaves equal ones on the
+    // stack, so the root is the leftmost minimum.
+    parent[i] = i;
+    while (!stack.empty() && b[i] < b[stack.back()]) {
+      parent[stack.back()] = i;
+      stack.pop_back();
+    }
+    stack.push_back(i);
+    for (index_type k = ending[i]; k != offline::none<index_type>(); k = next[k]) {
+      answers[k] = offline::find(parent, index_type(answers[k]));
+    }
+  }
+  return std::copy(answers.begin(), answers.end(), out);
+}
+
+/**
+ * Answers the LCA queries in [first, last) on the tree t: like
+ * lca::query_batch, the queries are pairs of pointers to t's nodes, and
+ * pointers to their lowest common ancestors are written to out, in
+ * order.
+ *
+ * This is Tarjan's offline algorithm: a DFS over t with a union-find
+ * forest where each finished subtree is linked under its parent, so
+ * that when the DFS finishes a node u, the root of any finished node w's
+ * set is the lowest ancestor of w the DFS hasn't finished, which is the
+ * LCA of u and w.  Each query is answered when the DFS finishes the
+ * second of its nodes.  The DFS uses an explicit stack, like lca's, so
+ * deep trees don't overflow the call stack.
+ *
+ * Nodes are numbered in a first pass, through a hash table from their
+ * addresses that only the queries are looked up in, since tree nodes
+ * don't have consecutive ids, and nothing is written to t.
+ * index_type is what the temporary arrays hold, and has to be able to
+ * hold the number of nodes and twice the number of queries.
+ */
+template<
+  typename index_type=std::ptrdiff_t,
+  typename value_type,
+  typename ForwardIterator,
+  typename OutputIterator
+  >
+OutputIterator offline_lca(const tree<value_type> &t,
+                           ForwardIterator first, ForwardIterator last,
+                           OutputIterator out) {
+  typedef tree<value_type> node_type;
+
+  // Number the nodes in the order the DFS below arrives at them.
+  std::vector<const node_type *> nodes;
+  std::unordered_map<const node_type *, index_type> ids;
+  {
+    std::vector<const node_type *> stack(1, &t);
+    while (!stack.empty()) {
+      const node_type *node = stack.back();
+      stack.pop_back();
+      ids.insert(std::make_pair(node, index_type(nodes.size())));
+      nodes.push_back(node);
+      for (auto c = node->children().rbegin(); c != node->children().rend(); ++c) {
+        stack.push_back(&*c);
+      }
+    }
+  }
+
+  // Each query is on the lists of both its nodes, at 2j and 2j + 1 in
+  // next and other, and other holds the node at the other end.
+  const index_type q = index_type(std::distance(first, last));
+  std::vector<const node_type *> answers(q);
+  std::vector<index_type> queries(nodes.size(), offline::none<index_type>());
+  std::vector<index_type> next(2 * q);
+  std::vector<index_type> other(2 * q);
+  index_type j = 0;
+  for (ForwardIterator it = first; it != last; ++it, ++j) {
+    const index_type u = ids.at(std::get<0>(*it));
+    const index_type v = ids.at(std::get<1>(*it));
+    next[2 * j] = queries[u];
+    other[2 * j] = v;
+    queries[u] = 2 * j;
+    next[2 * j + 1] = queries[v];
+    other[2 * j + 1] = u;
+    queries[v] = 2 * j + 1;
+  }
+
+  // The stack holds each node on the path from the root, its id and
+  // the index of its next child to visit.
+  struct frame {
+    const node_type *node;
+    index_type id;
+    size_t next_child;
+  };
+  std::vector<index_type> parent(nodes.size());
+  std::vector<bool> finished(nodes.size());
+  std::vector<frame> stack;
+  index_type next_id = 0;
+  auto arrive = [&nodes, &parent, &stack, &next_id](const node_type &node) {
+    const index_type u = next_id++;
+    assert(nodes[u] == &node);
+    parent[u] = u;
+    stack.push_back(frame{&node, u, 0});
+  };
+
+  arrive(t);
+  while (!stack.empty()) {
+    frame &top = stack.back();
+    if (top.next_child < top.node->children().size()) {
+      arrive(top.node->children()[top.next_child++]);
+      continue;
+    }
+
+    const index_type u = top.id;
+    finished[u] = true;
+    for (index_type k = queries[u]; k != offline::none<index_type>(); k = next[k]) {
+      if (finished[other[k]]) {
+        answers[k / 2] = nodes[offline::find(parent, other[k])];
+      }
+    }
+    stack.pop_back();
+    if (!stack.empty()) {
+      parent[u] = stack.back().id;
+    }
+  }
+  return std::copy(answers.begin(), answers.end(), out);
+}
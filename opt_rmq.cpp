@@ -1,4 +1,51 @@
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
 #include "opt_rmq.hpp"
 #include "rmq_test.hpp"
+#include "serialize.hpp"
+
+/**
+ * The saved tables of an opt_rmq built on input with threads threads.
+ */
+std::string saved(const std::vector<int> &input, unsigned threads) {
+  const opt_rmq<std::vector<int>::const_iterator, int,
+                std::vector<int>::difference_type, uint32_t> im(input.begin(), input.end(), threads);
+  std::ostringstream out;
+  index_writer writer(out);
+  im.save(writer);
+  return out.str();
+}
+
+/**
+ * Checks that building the Cartesian tree from nearest smaller values in
+ * parallel gives exactly the tree the sequential stack does, on inputs
+ * with long runs of ties and long monotone stretches, whose chains cross
+ * many chunks.
+ */
+void parallel_tree_test(size_t N) {
+  std::vector<std::vector<int> > inputs(5, std::vector<int>(N));
+  for (size_t i = 0; i < N; ++i) {
+    inputs[0][i] = std::rand() % 4;
+    inputs[1][i] = int(i);
+    inputs[2][i] = -int(i);
+    inputs[3][i] = 7;
+    inputs[4][i] = std::rand();
+  }
+  for (const std::vector<int> &input : inputs) {
+    const std::string expected = saved(input, 1);
+    for (unsigned threads : {2u, 3u, 8u}) {
+      assert(saved(input, threads) == expected);
+    }
+  }
+}
 
-TEST_IMPL(opt_rmq)
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(opt_rmq, 1000000);
+  RMQ_NARROW_TEST_BODY(opt_rmq, 1000000);
+  rmq_test::threaded_test<opt_rmq<std::vector<int>::const_iterator>>();
+  parallel_tree_test(100000);
+  return 0;
+}
@@ -3,149 +3,453 @@
  * and then back to ±1 RMQ.
  */
 
+#pragma once
+
 #include <algorithm>
-#include <assert.h>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
-#include <boost/tuple/tuple.hpp>
-
-#include "lca.hpp"
+#include "instrument.hpp"
+#include "parallel.hpp"
 #include "pm_rmq.hpp"
-#include "tree.hpp"
+#include "serialize.hpp"
+#include "simd.hpp"
+#include "table.hpp"
 
 template<
   typename iterator_type,
   typename value_type=typename std::iterator_traits<iterator_type>::value_type,
-  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
   >
-class opt_rmq : public rmq<iterator_type, value_type, difference_type> {
+class opt_rmq : public rmq<opt_rmq<iterator_type, value_type, difference_type, index_type>,
+                            iterator_type, value_type, difference_type> {
+
+  typedef rmq<opt_rmq, iterator_type, value_type, difference_type> rmq_base;
 
   // Compilers are dumb.
-  using rmq<iterator_type, value_type, difference_type>::begin;
-  using rmq<iterator_type, value_type, difference_type>::end;
-  using rmq<iterator_type, value_type, difference_type>::n;
-  using rmq<iterator_type, value_type, difference_type>::val;
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+  using rmq_base::prefetch;
 
   /**
-   * Our tree will store pairs of the input element, and the offset within
-   * the input represented by a node, so that once we compute the LCA in
-   * the tree, we can convert that node back to an offset within the
-   * original RMQ array.
+   * The Cartesian tree of the input, as flat arrays indexed by offset
+   * within the input (which is also each node's position in an inorder
+   * traversal).  none marks a missing parent or child.  We only need
+   * these during construction.
+   *
+   * Offsets, levels, positions in the Euler tour and the indexes stored
+   * inside the pm_rmq are all index_type, which can be narrower than
+   * difference_type to save space as long as it can hold the tour's
+   * positions, which go up to 2n - 2, with its largest value to spare
+   * for none.
    */
-  typedef std::pair<value_type, difference_type> tree_val_type;
-  typedef tree<tree_val_type> tree_type;
+  struct cartesian_tree {
+    static const index_type none = std::numeric_limits<index_type>::max();
+
+    index_type root;
+    std::vector<index_type> parent;
+    std::vector<index_type> left;
+    std::vector<index_type> right;
+  };
 
   /**
-   * Array associating indexes to tree nodes, so we can find the tree
-   * nodes corresponding to query offsets.
+   * The Euler tour of the Cartesian tree, as input offsets.
    */
-  std::vector<const tree_type *> _idx_to_node;
+  table<index_type> _euler;
 
   /**
-   * Cartesian tree of the input array.
+   * A vector of the same length as the Euler tour, stores the level of
+   * the node from which the ith element of the Euler tour came.
    */
-  tree_type _tree;
+  table<index_type> _level;
 
   /**
-   * Preprocessed LCA data structure answering queries on _tree.
+   * The "representative array" R from the paper: _repr[i] is the
+   * position of the first occurrence of the node for offset i in the
+   * Euler tour.
    */
-  lca<tree_val_type, pm_rmq<std::vector<ssize_t>::const_iterator> > _lca;
+  table<index_type> _repr;
+
+  /**
+   * The ±1 RMQ data structure for the _level array.
+   */
+  typedef typename table<index_type>::const_iterator level_iterator_type;
+  typedef pm_rmq<level_iterator_type, index_type,
+                 typename std::iterator_traits<level_iterator_type>::difference_type,
+                 index_type> level_rmq_type;
+  std::unique_ptr<level_rmq_type> _rmq;
+
+  /**
+   * Queries over at most this many values are answered by scanning them,
+   * which for a cache line of ints is much quicker than the chain of
+   * dependent lookups through _repr, the ±1 RMQ and _euler.  Even a
+   * short query's endpoints can be far apart in the Euler tour, so
+   * without this short queries cost as much as long ones.
+   */
+  static const difference_type scan_length = 16;
+
+  /**
+   * Returns the offset of the leftmost minimum in [lo, hi), which is
+   * what the Cartesian tree gives too (equal values become right
+   * children of the earlier one).
+   */
+  difference_type scan(difference_type lo, difference_type hi) const {
+    return scan(lo, hi, std::integral_constant<bool, simd::packable<iterator_type>::value>());
+  }
+
+  difference_type scan(difference_type lo, difference_type hi, std::false_type) const {
+    return std::min_element(begin() + lo, begin() + hi) - begin();
+  }
+
+  difference_type scan(difference_type lo, difference_type hi, std::true_type) const {
+    return lo + difference_type(simd::argmin(&*(begin() + lo), size_t(hi - lo)));
+  }
 
   /**
-   * Constructs the Cartesian tree for the input array.
+   * Constructs the Cartesian tree for the input array, using up to
+   * threads threads.
    */
-  static tree_type cartesian_tree(iterator_type b, iterator_type e) {
-    tree_type root(tree_val_type(*b, 0));
+  static cartesian_tree build_cartesian_tree(iterator_type b, iterator_type e, unsigned threads) {
+    RMQ_TIME("opt_rmq.build.cartesian_tree_ns");
+    return threads > 1 ? parallel_cartesian_tree(b, e, threads) : sequential_cartesian_tree(b, e);
+  }
 
-    // Our tree data structure doesn't maintain parent pointers, so we
-    // maintain parents temporarily with an explicit stack.
-    std::vector<tree_type *> rightmost_path;
-    rightmost_path.push_back(&root);
+  static cartesian_tree sequential_cartesian_tree(iterator_type b, iterator_type e) {
+    const index_type none = cartesian_tree::none;
+    const difference_type len = e - b;
+    cartesian_tree t;
+    t.parent.assign(len, none);
+    t.left.assign(len, none);
+    t.right.assign(len, none);
 
-    for (iterator_type c = b + 1; c != e; ++c) {
+    // The stack holds the rightmost path of the tree built so far.
+    std::vector<index_type> rightmost_path;
+    for (difference_type c = 0; c < len; ++c) {
       // Backtrack up the rightmost path until our current value is larger
-      // than the current value at the bottom of rightmost_path.
-      while (!rightmost_path.empty() && rightmost_path.back()->id().first > *c) {
+      // than the current value at the bottom of rightmost_path.  The last
+      // node we pop, if any, becomes our left child, to preserve the
+      // inorder traversal property.
+      index_type last = none;
+      while (!rightmost_path.empty() && b[rightmost_path.back()] > b[c]) {
+        last = rightmost_path.back();
         rightmost_path.pop_back();
       }
+      if (last != none) {
+        t.left[c] = last;
+        t.parent[last] = index_type(c);
+      }
+      // We become the right child of whatever's left at the bottom of the
+      // rightmost path, or the new root if nothing is.
+      if (!rightmost_path.empty()) {
+        t.right[rightmost_path.back()] = index_type(c);
+        t.parent[c] = rightmost_path.back();
+      }
+      rightmost_path.push_back(index_type(c));
+    }
+    t.root = rightmost_path.front();
+    return t;
+  }
+
+  /**
+   * The same tree, built from the all nearest smaller values instead.
+   * In the sequential loop, c's parent is either the node it's pushed
+   * onto, which is the nearest node to its left with a value no larger
+   * than its own, or the node that pops it, the nearest to its right
+   * with a smaller value.  It's the one that pops it if there is one and
+   * that one doesn't pop the other as well, i.e. if the left one's value
+   * is no larger than the right one's.
+   *
+   * Nearest smaller values are found within chunks of the input in
+   * parallel, with a stack each.  That leaves, in each chunk, the nodes
+   * with no smaller value to their left in the chunk, which are in
+   * decreasing order, and likewise on the right.  Those are resolved a
+   * chunk at a time, walking the chains of nearest smaller values out
+   * from the chunk's boundary, which skip everything in between.  Each
+   * chunk's nodes take up the walk where the last left off, so on most
+   * inputs that's a few steps per chunk.  Then parents, and from them
+   * children, are filled in in parallel.
+   */
+  static cartesian_tree parallel_cartesian_tree(iterator_type b, iterator_type e, unsigned threads) {
+    const index_type none = cartesian_tree::none;
+    const size_t len = size_t(e - b);
+    const size_t chunk = std::max(size_t(4096), (len + threads - 1) / threads);
+    const size_t num_chunks = (len + chunk - 1) / chunk;
 
-      // This is the value (user value and offset) to be stored in the
-      // tree node we're about to construct.
-      tree_val_type tree_val(*c, c - b);
-
-      if (rightmost_path.empty()) {
-        // Our element is smaller than the current root's element.  We
-        // need to construct a new root and make the old root its left
-        // child.
-        {
-          std::vector<tree_type> new_roots_children;
-          new_roots_children.push_back(std::move(root));
-          root = std::move(tree_type(std::move(tree_val), std::move(new_roots_children)));
+    // left_smaller[c] is the nearest node to c's left with a value no
+    // larger than its own, right_smaller[c] the nearest to its right
+    // with a smaller one, none if there isn't one (yet).
+    std::vector<index_type> left_smaller(len, none);
+    std::vector<index_type> right_smaller(len, none);
+    std::vector<std::vector<index_type> > left_unresolved(num_chunks);
+    std::vector<std::vector<index_type> > right_unresolved(num_chunks);
+    parallel_for(0, num_chunks, threads,
+                 [&](size_t lo_chunk, size_t hi_chunk) {
+                   std::vector<index_type> stack;
+                   for (size_t k = lo_chunk; k < hi_chunk; ++k) {
+                     const size_t lo = k * chunk;
+                     const size_t hi = std::min(len, lo + chunk);
+                     stack.clear();
+                     for (size_t c = lo; c < hi; ++c) {
+                       while (!stack.empty() && b[stack.back()] > b[c]) {
+                         stack.pop_back();
+                       }
+                       if (stack.empty()) {
+                         left_unresolved[k].push_back(index_type(c));
+                       } else {
+                         left_smaller[c] = stack.back();
+                       }
+                       stack.push_back(index_type(c));
+                     }
+                     stack.clear();
+                     for (size_t c = hi; c-- > lo;) {
+                       while (!stack.empty() && !(b[stack.back()] < b[c])) {
+                         stack.pop_back();
+                       }
+                       if (stack.empty()) {
+                         right_unresolved[k].push_back(index_type(c));
+                       } else {
+                         right_smaller[c] = stack.back();
+                       }
+                       stack.push_back(index_type(c));
+                     }
+                   }
+                 }, 1);
+
+    // Chunks' left ends are resolved left to right, and right ends right
+    // to left, so the chains walked are already resolved.
+    for (size_t k = 1; k < num_chunks; ++k) {
+      index_type j = index_type(k * chunk - 1);
+      for (index_type c : left_unresolved[k]) {
+        while (j != none && b[j] > b[c]) {
+          j = left_smaller[j];
         }
-        rightmost_path.push_back(&root);
-      } else {
-        // We need to create a new right child of the bottom of our
-        // rightmost_path.  If it already has a right child, we need to
-        // make that our new node's left child to preserve the inorder
-        // traversal property.  If it doesn't have a right child, we can
-        // just insert a leaf node.
-        tree_type &new_parent = *rightmost_path.back();
-        if (!new_parent.children().empty() &&
-            // Since our tree is n-ary, it doesn't have a concept of
-            // "left" and "right" children.  We use the inorder traversal
-            // property we're supposed to be maintaining to check whether
-            // a right child exists.  If it does, new_parent's RMQ input
-            // index will be smaller than its last child's.
-            new_parent.id().second < new_parent.children().back().id().second) {
-          // We have a right child.  We need to replace it with our new node which must have the old right child as its left child.
-          {
-            std::vector<tree_type> new_subtrees_children;
-            new_subtrees_children.push_back(std::move(new_parent.children().back()));
-            new_parent.children().back() = std::move(tree_type(std::move(tree_val), std::move(new_subtrees_children)));
-          }
-        } else {
-          // No right child, we can insert a fresh leaf node there.
-          new_parent.children().push_back(std::move(tree_type(std::move(tree_val))));
+        left_smaller[c] = j;
+      }
+    }
+    for (size_t k = num_chunks - 1; k-- > 0;) {
+      index_type j = index_type((k + 1) * chunk);
+      for (index_type c : right_unresolved[k]) {
+        while (j != none && !(b[j] < b[c])) {
+          j = right_smaller[j];
+        }
+        right_smaller[c] = j;
+      }
+    }
+
+    // The root is the leftmost minimum, the one node with neither, and
+    // one of some chunk's unresolved nodes on the left.
+    cartesian_tree t;
+    t.root = none;
+    for (const std::vector<index_type> &unresolved : left_unresolved) {
+      for (index_type c : unresolved) {
+        if (left_smaller[c] == none && right_smaller[c] == none) {
+          t.root = c;
         }
-        // Either way, we just added a new node on the rightmost path.
-        rightmost_path.push_back(const_cast<tree_type *>(&new_parent.children().back()));
       }
     }
-    return root;
+
+    // Each parent replaces the left smaller value it's chosen from.
+    parallel_for(0, len, threads,
+                 [&](size_t lo, size_t hi) {
+                   for (size_t c = lo; c < hi; ++c) {
+                     const index_type l = left_smaller[c];
+                     const index_type r = right_smaller[c];
+                     if (r != none && (l == none || !(b[r] < b[l]))) {
+                       left_smaller[c] = r;
+                     }
+                   }
+                 });
+    t.parent.swap(left_smaller);
+    right_smaller = std::vector<index_type>();
+
+    // Every node has at most one child on each side, so no two nodes
+    // write the same entry.
+    t.left.assign(len, none);
+    t.right.assign(len, none);
+    parallel_for(0, len, threads,
+                 [&t, none](size_t lo, size_t hi) {
+                   for (size_t c = lo; c < hi; ++c) {
+                     const index_type p = t.parent[c];
+                     if (p != none) {
+                       (size_t(p) < c ? t.right : t.left)[p] = index_type(c);
+                     }
+                   }
+                 });
+    return t;
   }
 
   /**
-   * We would be able to construct this array while building the Cartesian
-   * tree if our tree nodes were immutable, but we're using std::move so
-   * we have to wait until the tree is finished reshaping before computing
-   * this array.
+   * Fills in _euler, _level and _repr (taken from storage, if it's given)
+   * with a DFS of the Cartesian tree, emitting each node upon arrival and
+   * also upon completion of the search of each of its children.  The
+   * parent pointers let us walk the tree without a stack or recursion,
+   * however deep it is.
    */
-  void fill_idx_to_node(const tree_type &t) {
-    _idx_to_node[t.id().second] = &t;
-    std::for_each(t.children().begin(), t.children().end(),
-                  [this](const tree_type &c) {
-                    fill_idx_to_node(c);
-                  });
+  void euler_tour(const cartesian_tree &t, arena *storage) {
+    RMQ_TIME("opt_rmq.build.euler_tour_ns");
+    const index_type none = cartesian_tree::none;
+    _euler = table<index_type>(2 * n() - 1, storage);
+    _level = table<index_type>(2 * n() - 1, storage);
+    _repr = table<index_type>(n(), storage);
+
+    index_type node = t.root;
+    index_type level = 0;
+    // Which of node's children we just finished, none if we just arrived.
+    index_type from = none;
+    size_t pos = 0;
+    _repr[node] = index_type(pos);
+    _euler[pos] = node;
+    _level[pos] = level;
+    ++pos;
+    for (;;) {
+      index_type next = none;
+      if (from == none && t.left[node] != none) {
+        next = t.left[node];
+      } else if (from != t.right[node] && t.right[node] != none) {
+        next = t.right[node];
+      }
+
+      if (next != none) {
+        node = next;
+        ++level;
+        from = none;
+        _repr[node] = index_type(pos);
+      } else if (node == t.root) {
+        break;
+      } else {
+        from = node;
+        node = t.parent[node];
+        --level;
+      }
+      _euler[pos] = node;
+      _level[pos] = level;
+      ++pos;
+    }
   }
 
 public:
-  opt_rmq(iterator_type b, iterator_type e)
-    : rmq<iterator_type, value_type, difference_type>(b, e),
-      _idx_to_node(n()),
-      _tree(cartesian_tree(b, e)),
-      _lca(_tree)
+  /**
+   * Preprocess the array [b,e) for RMQ queries, building the Cartesian
+   * tree and the pm_rmq over the levels with up to threads threads (the
+   * Euler tour is built sequentially).  The tables (including the
+   * pm_rmq's) are taken from storage if it's given.  The Cartesian tree
+   * is only needed during construction, so it stays on the heap rather
+   * than taking space in the arena for as long as the index lives.
+   */
+  opt_rmq(iterator_type b, iterator_type e, unsigned threads = 1,
+          arena *storage = nullptr)
+    : rmq_base(b, e)
+  {
+    RMQ_COUNT("opt_rmq.builds");
+    euler_tour(build_cartesian_tree(b, e, threads), storage);
+    RMQ_TIME("opt_rmq.build.level_rmq_ns");
+    _rmq.reset(new level_rmq_type(_level.cbegin(), _level.cend(), threads, storage));
+  }
+
+  /**
+   * Loads the tables for the array [b,e) saved by save(), viewing them in
+   * place.  See serialize.hpp.
+   */
+  opt_rmq(iterator_type b, iterator_type e, index_reader &in)
+    : rmq_base(b, e)
   {
-    fill_idx_to_node(_tree);
+    in.read_header<value_type, index_type>(index_kind::opt, n());
+    _euler = in.read_table<index_type>(2 * n() - 1);
+    _level = in.read_table<index_type>(2 * n() - 1);
+    _repr = in.read_table<index_type>(n());
+    _rmq.reset(new level_rmq_type(_level.cbegin(), _level.cend(), in));
+  }
+
+  void save(index_writer &out) const {
+    out.write_header<value_type, index_type>(index_kind::opt, n());
+    out.write_table(_euler);
+    out.write_table(_level);
+    out.write_table(_repr);
+    _rmq->save(out);
+  }
+
+  /**
+   * The Cartesian tree is gone by the time construction finishes, so it
+   * isn't part of this.
+   */
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("euler_tour", _euler.bytes_used());
+    usage.add("levels", _level.bytes_used());
+    usage.add("repr", _repr.bytes_used());
+    usage.add("level_rmq", _rmq->memory_usage());
+    return usage;
   }
 
   difference_type query(iterator_type u, iterator_type v) const {
-    // To query, we use the query iterators' offsets and _idx_to_node to
-    // find their corresponding nodes in the tree, run an LCA query on
-    // those nodes, and report the returned node's offset.
-    return _lca.query(*_idx_to_node[u - begin()],
-                      *_idx_to_node[v - 1 - begin()]).second;
+    // To query, we use the query iterators' offsets and _repr to find
+    // their corresponding nodes in the Euler tour, run a ±1 RMQ query
+    // between them to find their LCA, and report its offset.
+    RMQ_RECORD("opt_rmq.query_length", v - u);
+    if (v - u <= scan_length) {
+      RMQ_COUNT("opt_rmq.query.scan");
+      return scan(u - begin(), v - begin());
+    }
+    RMQ_COUNT("opt_rmq.query.lca");
+    const index_type ui = _repr[u - begin()];
+    const index_type vi = _repr[v - 1 - begin()];
+
+    // The RMQ interface uses an exclusive upper bound so we need to go
+    // one past that to include the node represented by the upper bound
+    // here.
+    return _euler[ui <= vi
+                  ? _rmq->query_offset(ui, vi + 1)
+                  : _rmq->query_offset(vi, ui + 1)];
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    // Gather the queries too long to scan, prefetching their _repr
+    // entries, then batch their ±1 RMQ queries, then prefetch their Euler
+    // tour entries and scan the short queries while those arrive.
+    size_t long_is[rmq_base::chunk_size];
+    size_t long_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      RMQ_RECORD("opt_rmq.query_length", vos[i] - uos[i]);
+      if (vos[i] - uos[i] > scan_length) {
+        RMQ_COUNT("opt_rmq.query.lca");
+        long_is[long_count++] = i;
+        prefetch(&_repr[uos[i]]);
+        prefetch(&_repr[vos[i] - 1]);
+      } else {
+        RMQ_COUNT("opt_rmq.query.scan");
+        prefetch(&val(uos[i]));
+      }
+    }
+    difference_type uis[rmq_base::chunk_size];
+    difference_type vis[rmq_base::chunk_size];
+    for (size_t j = 0; j < long_count; ++j) {
+      const index_type ui = _repr[uos[long_is[j]]];
+      const index_type vi = _repr[vos[long_is[j]] - 1];
+      uis[j] = std::min(ui, vi);
+      vis[j] = std::max(ui, vi) + 1;
+    }
+    difference_type idxs[rmq_base::chunk_size];
+    if (long_count > 0) {
+      _rmq->query_chunk(uis, vis, long_count, idxs);
+    }
+    for (size_t j = 0; j < long_count; ++j) {
+      prefetch(&_euler[idxs[j]]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+      if (vos[i] - uos[i] <= scan_length) {
+        out[i] = scan(uos[i], vos[i]);
+      }
+    }
+    for (size_t j = 0; j < long_count; ++j) {
+      out[long_is[j]] = _euler[idxs[j]];
+    }
   }
 };
@@ -0,0 +1,44 @@
+/**
+ * A helper for splitting data-parallel construction work across threads.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/**
+ * Calls f(lo, hi) on consecutive, disjoint ranges [lo, hi) covering
+ * [begin, end), using up to threads threads (including the calling
+ * one).  We don't bother handing a thread less than min_grain items, so
+ * small ranges just run on the calling thread.
+ *
+ * How the range is split depends only on its size and threads, so as
+ * long as each call of f only writes to its own range, the results don't
+ * depend on the number of threads.
+ */
+template<
+  typename Function
+  >
+void parallel_for(size_t begin, size_t end, unsigned threads, Function f,
+                  size_t min_grain = 4096) {
+  const size_t len = end > begin ? end - begin : 0;
+  const size_t parts = std::max(size_t(1), std::min(size_t(threads), len / min_grain));
+  if (parts == 1) {
+    f(begin, end);
+    return;
+  }
+
+  const size_t per_part = (len + parts - 1) / parts;
+  std::vector<std::thread> workers;
+  for (size_t lo = begin + per_part; lo < end; lo += per_part) {
+    const size_t hi = std::min(end, lo + per_part);
+    workers.push_back(std::thread([&f, lo, hi]() { f(lo, hi); }));
+  }
+  f(begin, begin + per_part);
+  for (std::thread &t : workers) {
+    t.join();
+  }
+}
@@ -1,4 +1,29 @@
 #include "pm_rmq.hpp"
 #include "pm_rmq_test.hpp"
 
-TEST_IMPL(pm_rmq)
+// Blocks narrower than a byte of steps and full 64-element blocks, both
+// of which have to handle the padding of the last byte scanned.
+template<typename iterator_type>
+using small_block_pm_rmq =
+  pm_rmq<iterator_type,
+         typename std::iterator_traits<iterator_type>::value_type,
+         typename std::iterator_traits<iterator_type>::difference_type,
+         typename std::iterator_traits<iterator_type>::difference_type,
+         5>;
+
+template<typename iterator_type>
+using word_block_pm_rmq =
+  pm_rmq<iterator_type,
+         typename std::iterator_traits<iterator_type>::value_type,
+         typename std::iterator_traits<iterator_type>::difference_type,
+         typename std::iterator_traits<iterator_type>::difference_type,
+         64>;
+
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(pm_rmq);
+  RMQ_NARROW_TEST_BODY(pm_rmq);
+  rmq_test::threaded_test<pm_rmq<std::vector<int>::const_iterator>>();
+  RMQ_TEST_BODY(small_block_pm_rmq);
+  RMQ_TEST_BODY(word_block_pm_rmq);
+  return 0;
+}
@@ -1,163 +1,319 @@
 /**
- * Implements the <O(n), O(1)> ±1 RMQ solution.
+ * Implements the <O(n), O(1)> ±1 RMQ solution, with blocks of up to 64
+ * elements answered with bit tricks on their step signatures rather than
+ * tables of every block shape.
  */
 
+#pragma once
+
 #include <algorithm>
 #include <cassert>
-#include <cmath>
+#include <cstdint>
 #include <functional>
 #include <iterator>
-#include <map>
+#include <limits>
 #include <memory>
+#include <type_traits>
 #include <utility>
-#include <vector>
 
 #include <boost/iterator/counting_iterator.hpp>
 #include <boost/iterator/zip_iterator.hpp>
 #include <boost/tuple/tuple.hpp>
 
+#include "instrument.hpp"
+#include "parallel.hpp"
 #include "rmq.hpp"
+#include "serialize.hpp"
+#include "simd.hpp"
+#include "table.hpp"
 
-#include "naive_rmq.hpp"
 #include "sparse_rmq.hpp"
 
+/**
+ * The paper uses blocks of lg(n)/2 elements, so that a table of answers
+ * for every possible block shape takes o(n) space.  Here a block's
+ * shape is its signature, one bit per step, and in-block queries are
+ * answered from the signature itself a byte of steps at a time, so the
+ * only table is a 256 entry one shared by every block size.  That lets
+ * blocks be as long as a signature word, so the super array and its
+ * sparse_rmq take far less space than lg(n)/2 blocks give them (which
+ * at large n is most of the structure), at the cost of up to
+ * block_size/8 steps per in-block query.
+ *
+ * block_size comes after the usual template parameters so that it can
+ * have a default, and can be at most 64.
+ */
 template<
   typename iterator_type,
   typename value_type=typename std::iterator_traits<iterator_type>::value_type,
-  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type,
+  size_t block_size=32
   >
-class pm_rmq : public rmq<iterator_type, value_type, difference_type> {
+class pm_rmq : public rmq<pm_rmq<iterator_type, value_type, difference_type, index_type, block_size>,
+                           iterator_type, value_type, difference_type> {
+
+  static_assert(block_size > 0 && block_size <= 64,
+                "a block's steps have to fit in a 64-bit signature");
+
+  typedef rmq<pm_rmq, iterator_type, value_type, difference_type> rmq_base;
 
   // Compilers are dumb.
-  using rmq<iterator_type, value_type, difference_type>::begin;
-  using rmq<iterator_type, value_type, difference_type>::end;
-  using rmq<iterator_type, value_type, difference_type>::n;
-  using rmq<iterator_type, value_type, difference_type>::val;
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+  using rmq_base::prefetch;
+
+  static const difference_type bs = block_size;
 
   /**
-   * The log_2 of the problem size, lg(n).
+   * Arrays of length n/block_size where the first array contains the
+   * minimum element in the ith block of the input, and the second
+   * contains the position of that element (as an offset from the
+   * beginning of the original input, not from the beginning of the
+   * block).  Positions are stored as index_type, which can be narrower
+   * than difference_type to save space as long as it can hold n().
    */
-  const difference_type _logn;
+  table<value_type> _super_array_vals;
+  table<index_type> _super_array_idxs;
 
   /**
-   * The block size is lg(n)/2.
+   * The sparse RMQ implementation over _super_array_vals, which stores
+   * its indexes as index_type too.
    */
-  const difference_type block_size() const {
-    return std::max(difference_type(1), _logn / 2);
-  }
+  typedef typename table<value_type>::const_iterator super_iterator_type;
+  typedef sparse_rmq<super_iterator_type, value_type,
+                     typename std::iterator_traits<super_iterator_type>::difference_type,
+                     index_type> super_rmq_type;
+  std::unique_ptr<super_rmq_type> _super_rmq;
 
   /**
-   * Arrays of length 2n/lg(n) where the first array contains the minimum
-   * element in the ith block of the input, and the second contains the
-   * position of that element (as an offset from the beginning of the
-   * original input, not from the beginning of the block).
+   * Because of the ±1 property, a block is determined (up to the value
+   * of its first element, which doesn't affect where its minima are) by
+   * the sequence of steps between consecutive elements.  We encode that
+   * sequence as a block_size-1 bit integer we call the block's
+   * signature: bit i is set if element i+1 of the block is one greater
+   * than element i, and clear if it is one less.
+   *
+   * The last block might be shorter than block_size, its missing steps
+   * are left clear.  Queries never reach past the end of the input, so
+   * this doesn't affect any answer we'll look up.
    */
-  std::vector<value_type> _super_array_vals;
-  std::vector<difference_type> _super_array_idxs;
+  typedef typename std::conditional<block_size <= 33, uint32_t, uint64_t>::type
+    block_signature_type;
 
   /**
-   * The sparse RMQ implementation over _super_array_vals;
+   * The signature of each sub block, indexed by block number.  This is
+   * all we need to answer queries within a block at query time.
    */
-  std::unique_ptr<sparse_rmq<typename std::vector<value_type>::const_iterator> > _super_rmq;
+  table<block_signature_type> _sub_block_signatures;
 
   /**
-   * We use a vector<value_type> to represent a normalized block.  We
-   * could use a vector<bool> but that would require building another
-   * temporary array, this is simpler, if less space efficient.
-   *
-   * We keep a map of them while building them to dedupe and to own the
-   * memory, and an array of them indexed by block number to use at query
-   * time.
-   *
-   * This is the biggest opportunity for optimization.  The paper suggests
-   * keeping a table of all sqrt(n) possible sub blocks.  We only keep
-   * ones that exist in order to simplify handling of the last block
-   * (which might be shorter).  However, our solution involves a bunch of
-   * copying that makes it slower.
+   * Precomputed answers for scanning a signature a byte of steps at a
+   * time: the change in height over the byte, and the minimum (relative)
+   * height after each of its steps and the rightmost step after which it
+   * occurs.  This is succinct_rmq's table for its parentheses, which are
+   * steps too.
    */
-  typedef std::vector<value_type> block_identifier;
+  struct byte_info {
+    int8_t total;
+    int8_t min;
+    uint8_t pos;
+  };
+
+  struct byte_table {
+    byte_info entries[256];
+
+    byte_table() {
+      for (unsigned x = 0; x < 256; ++x) {
+        int height = 0;
+        int min = std::numeric_limits<int>::max();
+        unsigned pos = 0;
+        for (unsigned b = 0; b < 8; ++b) {
+          height += ((x >> b) & 1) ? 1 : -1;
+          if (height <= min) {
+            min = height;
+            pos = b;
+          }
+        }
+        entries[x].total = int8_t(height);
+        entries[x].min = int8_t(min);
+        entries[x].pos = uint8_t(pos);
+      }
+    }
+  };
+
+  static const byte_info *bytes() {
+    static const byte_table table;
+    return table.entries;
+  }
 
   /**
-   * We'll use a naive_rmq over block_identifiers to represent the
-   * precomputed RMQ answers for sub blocks.
+   * The offset of the (rightmost) minimum in [i, j] (inclusive) of a
+   * block with signature s, found by walking the steps from i to j a
+   * byte at a time.  The steps past j are replaced with up steps, which
+   * climb above the height at j and so can't be (or tie) the minimum,
+   * so the last byte needs no special case.
    */
-  typedef naive_rmq<typename std::vector<value_type>::const_iterator> sub_block_rmq;
+  static difference_type in_block_query(uint64_t s, difference_type i, difference_type j) {
+    const difference_type len = j - i;
+    uint64_t steps = (s >> i) | (~uint64_t(0) << len);
+    difference_type height = 0;
+    difference_type min_height = 0;
+    difference_type min_pos = 0;
+    const byte_info *table = bytes();
+    for (difference_type k = 0; k < len; k += 8, steps >>= 8) {
+      const byte_info &b = table[steps & 0xff];
+      if (height + b.min <= min_height) {
+        min_height = height + b.min;
+        min_pos = k + b.pos + 1;
+      }
+      height += b.total;
+    }
+    return i + min_pos;
+  }
 
   /**
-   * The map from block_identifier to the naive_rmq solution on blocks of
-   * that shape.  This map is responsible for the lifetime of each
-   * naive_rmq, and for ensuring that we only build one naive_rmq for each
-   * shape of sub block.  Once the naive_rmq structures are built, we
-   * don't really use this map again.
+   * Finds the minimum and signature of blocks [lo, hi).
    */
-  std::map<block_identifier, std::unique_ptr<sub_block_rmq> > _sub_block_rmqs;
+  void scan_blocks(difference_type lo, difference_type hi) {
+    for (difference_type k = lo; k < hi; ++k) {
+      const iterator_type block_begin = begin() + k * bs;
+      const iterator_type block_end = std::min(block_begin + bs, end());
+      _sub_block_signatures[k] =
+        signature(block_begin, block_end,
+                  std::integral_constant<bool, simd::packable<iterator_type>::value>());
+
+      // The block's signature already tells us where its minimum is, so
+      // we look it up rather than scanning the block again.
+      const difference_type min_idx = sub_block_query(k, 0, block_end - block_begin - 1);
+      _super_array_vals[k] = val(min_idx);
+      _super_array_idxs[k] = min_idx;
+    }
+  }
 
   /**
-   * An array mapping sub blocks (by their index) to the naive_rmq
-   * implementation representing sub blocks of their shape.  We need to do
-   * this lookup at query time so we can't afford to reconstruct the
-   * block_identifier and query in the map.
+   * Computes the signature of the block [b, e).
    */
-  std::vector<sub_block_rmq *> _sub_block_rmq_array;
+  static block_signature_type signature(iterator_type b, iterator_type e, std::false_type) {
+    block_signature_type s = 0;
+    difference_type i = 0;
+    for (iterator_type it = b; it + 1 < e; ++it, ++i) {
+      if (*it < *(it + 1)) {
+        s |= block_signature_type(1) << i;
+      }
+    }
+    return s;
+  }
 
   /**
-   * Normalizes a sub_block so that it starts with 0.  Appends results to
-   * an OutputIterator.
+   * The same, for blocks of contiguous arithmetic values, whose steps
+   * simd::step_mask can compare many at a time.
    */
-  template<
-    typename OutputIterator
-    >
-  static void normalize(iterator_type b, iterator_type e,
-                        OutputIterator o) {
-    const value_type &init = *b;
-    std::transform(b, e, o,
-                   [init](const value_type &val) { return val - init; });
+  static block_signature_type signature(iterator_type b, iterator_type e, std::true_type) {
+    return block_signature_type(simd::step_mask(&*b, e - b - 1));
+  }
+
+  /**
+   * Answers a query for the minimum in the range [i, j] (inclusive, as
+   * offsets from the beginning of the block) within block number
+   * block_idx, returning an offset from the beginning of the input.
+   */
+  difference_type sub_block_query(difference_type block_idx,
+                                  difference_type i, difference_type j) const {
+    return (block_idx * bs) + in_block_query(_sub_block_signatures[block_idx], i, j);
+  }
+
+  /**
+   * Combines the answers for the partial blocks at either end of a query
+   * with the answer super_idx from the super array for the blocks in
+   * between.
+   */
+  difference_type combine(difference_type u_min_idx, difference_type v_min_idx,
+                          difference_type super_idx) const {
+    const value_type &u_min_val = val(u_min_idx);
+    const value_type &v_min_val = val(v_min_idx);
+    if (u_min_val < v_min_val) {
+      return u_min_val < _super_array_vals[super_idx] ? u_min_idx : _super_array_idxs[super_idx];
+    } else {
+      return v_min_val < _super_array_vals[super_idx] ? v_min_idx : _super_array_idxs[super_idx];
+    }
   }
 
 public:
-  pm_rmq(iterator_type b, iterator_type e)
-    : rmq<iterator_type, value_type, difference_type>(b, e),
-      _logn(std::max(difference_type(1),
-                     difference_type(std::floor(std::log2(n())))))
+  /**
+   * Preprocess the array [b,e) for RMQ queries, using up to threads
+   * threads, and taking the tables (including the super array's
+   * sparse_rmq's) from storage if it's given.
+   */
+  pm_rmq(iterator_type b, iterator_type e, unsigned threads = 1,
+         arena *storage = nullptr)
+    : rmq_base(b, e)
   {
 #ifndef NDEBUG
     // Check the ±1 property.
     std::for_each(boost::make_zip_iterator(boost::make_tuple(b, b + 1)),
                   boost::make_zip_iterator(boost::make_tuple(e - 1, e)),
                   [b, e](const boost::tuple<const value_type&, const value_type&>& t) {
-                    auto diff = t.template get<0>() - t.template get<1>();
-                    assert(diff == -1 || diff == 1);
+                    // Without subtracting, which unsigned levels would wrap.
+                    const value_type &x = t.template get<0>();
+                    const value_type &y = t.template get<1>();
+                    assert(x + 1 == y || y + 1 == x);
                   });
 #endif
 
     // For each sub_block, we'll add it to the _super_arrays and also
-    // normalize it and compute its naive_rmq.
-    for (iterator_type block_begin = begin(); block_begin < end(); block_begin += block_size()) {
-      const iterator_type block_end = std::min(block_begin + block_size(), end());
-
-      // Find the min element of the block by brute force.
-      const iterator_type block_min = std::min_element(block_begin, block_end);
-      _super_array_vals.push_back(*block_min);
-      _super_array_idxs.push_back(block_min - begin());
-
-      // Compute the normalized block.
-      std::vector<value_type> normalized_block(block_end - block_begin);
-      normalize(block_begin, block_end, normalized_block.begin());
-
-      // Find the normalized block in the map of RMQ structures.  If not
-      // found, construct one.
-      std::unique_ptr<sub_block_rmq> &naive_ptr = _sub_block_rmqs[normalized_block];
-      if (!naive_ptr) {
-        naive_ptr.reset(new sub_block_rmq(normalized_block.begin(), normalized_block.end()));
-      }
-
-      // Either way, record a pointer to the RMQ structure at this
-      // sub_block's index.
-      _sub_block_rmq_array.push_back(naive_ptr.get());
+    // record its signature.  Blocks are independent, so we split them
+    // across threads.
+    RMQ_COUNT("pm_rmq.builds");
+    const difference_type num_blocks = (n() + bs - 1) / bs;
+    _super_array_vals = table<value_type>(num_blocks, storage);
+    _super_array_idxs = table<index_type>(num_blocks, storage);
+    _sub_block_signatures = table<block_signature_type>(num_blocks, storage);
+    {
+      RMQ_TIME("pm_rmq.build.block_scan_ns");
+      parallel_for(0, num_blocks, threads,
+                   [this](size_t lo, size_t hi) {
+                     scan_blocks(lo, hi);
+                   });
     }
 
     // Construct the RMQ structure over the super array.
-    _super_rmq.reset(new sparse_rmq<typename std::vector<value_type>::const_iterator>(_super_array_vals.begin(), _super_array_vals.end()));
+    RMQ_TIME("pm_rmq.build.super_rmq_ns");
+    _super_rmq.reset(new super_rmq_type(_super_array_vals.cbegin(), _super_array_vals.cend(),
+                                        threads, storage));
+  }
+
+  /**
+   * Loads the tables for the array [b,e) saved by save(), viewing them in
+   * place.  See serialize.hpp.
+   */
+  pm_rmq(iterator_type b, iterator_type e, index_reader &in)
+    : rmq_base(b, e)
+  {
+    const size_t num_blocks = (n() + bs - 1) / bs;
+    in.read_header<value_type, index_type>(index_kind::pm, n(), block_size);
+    _sub_block_signatures = in.read_table<block_signature_type>(num_blocks);
+    _super_array_vals = in.read_table<value_type>(num_blocks);
+    _super_array_idxs = in.read_table<index_type>(num_blocks);
+    _super_rmq.reset(new super_rmq_type(_super_array_vals.cbegin(), _super_array_vals.cend(), in));
+  }
+
+  void save(index_writer &out) const {
+    out.write_header<value_type, index_type>(index_kind::pm, n(), block_size);
+    out.write_table(_sub_block_signatures);
+    out.write_table(_super_array_vals);
+    out.write_table(_super_array_idxs);
+    _super_rmq->save(out);
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("super_array", _super_array_vals.bytes_used() + _super_array_idxs.bytes_used());
+    usage.add("block_signatures", _sub_block_signatures.bytes_used());
+    usage.add("super_rmq", _super_rmq->memory_usage());
+    return usage;
   }
 
   difference_type query(iterator_type u, iterator_type v) const {
@@ -165,63 +321,122 @@ public:
     // the blocks that contain u and v (taking care to consider v being
     // the inclusive endpoint even though the API understands it to be
     // exclusive), then use a sparse_rmq search over the super array among
-    // blocks strictly between u's and v's blocks, and do naive_rmq
-    // searches in the representative structures for the blocks with u's
-    // and v's blocks' shapes.
+    // blocks strictly between u's and v's blocks, and look up the answers
+    // within u's and v's blocks from their blocks' signatures.
     //
     // Most of what's below is dealing with types and offset math, and
     // isn't all that interesting.
+    RMQ_RECORD("pm_rmq.query_length", v - u);
 
-    const difference_type u_block_idx = difference_type(u - begin()) / block_size();
-    const difference_type u_offset = difference_type(u - begin()) % block_size();
-    const difference_type v_block_idx = difference_type(v - 1 - begin()) / block_size();
-    const difference_type v_offset = difference_type(v - 1 - begin()) % block_size();
-
-    const sub_block_rmq &u_naive = *_sub_block_rmq_array[u_block_idx];
-    const sub_block_rmq &v_naive = *_sub_block_rmq_array[v_block_idx];
+    const difference_type u_block_idx = difference_type(u - begin()) / bs;
+    const difference_type u_offset = difference_type(u - begin()) % bs;
+    const difference_type v_block_idx = difference_type(v - 1 - begin()) / bs;
+    const difference_type v_offset = difference_type(v - 1 - begin()) % bs;
 
     const difference_type block_diff = v_block_idx - u_block_idx;
     if (block_diff == 0) {
 
-      // u and v are in the same block.  One naive_rmq search suffices.
-      return (u_block_idx * block_size()) + u_naive.query_offset(u_offset, v_offset + 1);
+      // u and v are in the same block.  One in-block query suffices.
+      RMQ_COUNT("pm_rmq.query.same_block");
+      return sub_block_query(u_block_idx, u_offset, v_offset);
 
     } else {
 
-      const iterator_type u_block_end = std::min(end(), begin() + ((u_block_idx + 1) * block_size()));
-
-      // u and v are in different blocks.  First, do naive_rmq searches in
-      // each block from u to the end of its block, and from the beginning
-      // of v's block to v.  Then also translate these to offsets within
-      // the original array, because that's what we intend to return.
-      const difference_type u_min_idx = (u_block_idx * block_size()) +
-        u_naive.query_offset(u_offset,
-                             u_block_end - (begin() + (block_size() * u_block_idx)));
-      const difference_type v_min_idx = (v_block_idx * block_size()) +
-        v_naive.query_offset(0, v_offset + 1);
+      // u and v are in different blocks.  First, look up the answers in
+      // each block from u to the end of its block (which, coming before
+      // v's, can't be the short last block), and from the beginning of
+      // v's block to v.  These come back as offsets within the original
+      // array, because that's what we intend to return.
+      const difference_type u_min_idx = sub_block_query(u_block_idx, u_offset, bs - 1);
+      const difference_type v_min_idx = sub_block_query(v_block_idx, 0, v_offset);
 
       if (block_diff == 1) {
 
         // u and v are in adjacent blocks.  Don't query the super array,
         // it doesn't handle zero-length intervals properly.
+        RMQ_COUNT("pm_rmq.query.adjacent_blocks");
         return val(u_min_idx) < val(v_min_idx) ? u_min_idx : v_min_idx;
 
       } else {
 
         // Full algorithm, using the sparse RMQ implementation on the
         // super array between u's and v's blocks.
+        RMQ_COUNT("pm_rmq.query.super_array");
 
         const difference_type super_idx = _super_rmq->query(_super_array_vals.begin() + u_block_idx + 1,
                                                             _super_array_vals.begin() + v_block_idx);
 
-        const value_type &u_min_val = val(u_min_idx);
-        const value_type &v_min_val = val(v_min_idx);
-        if (u_min_val < v_min_val) {
-          return u_min_val < _super_array_vals[super_idx] ? u_min_idx : _super_array_idxs[super_idx];
-        } else {
-          return v_min_val < _super_array_vals[super_idx] ? v_min_idx : _super_array_idxs[super_idx];
+        return combine(u_min_idx, v_min_idx, super_idx);
+      }
+    }
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    // Same algorithm as query(), but done in phases across the whole
+    // chunk so that the misses of independent queries overlap.
+
+    // First, find the blocks containing each query's endpoints, and
+    // prefetch their signatures.
+    difference_type u_block_idxs[rmq_base::chunk_size];
+    difference_type v_block_idxs[rmq_base::chunk_size];
+    for (size_t i = 0; i < count; ++i) {
+      RMQ_RECORD("pm_rmq.query_length", vos[i] - uos[i]);
+      u_block_idxs[i] = uos[i] / bs;
+      v_block_idxs[i] = (vos[i] - 1) / bs;
+      prefetch(&_sub_block_signatures[u_block_idxs[i]]);
+      prefetch(&_sub_block_signatures[v_block_idxs[i]]);
+    }
+
+    // Next, answer the in-block parts of every query, prefetch the input
+    // values we'll compare, and gather the queries that also need the
+    // super array into a chunk of their own for _super_rmq.
+    difference_type u_min_idxs[rmq_base::chunk_size];
+    difference_type v_min_idxs[rmq_base::chunk_size];
+    difference_type super_uos[rmq_base::chunk_size];
+    difference_type super_vos[rmq_base::chunk_size];
+    size_t super_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const difference_type u_offset = uos[i] - u_block_idxs[i] * bs;
+      const difference_type v_offset = vos[i] - 1 - v_block_idxs[i] * bs;
+      const difference_type block_diff = v_block_idxs[i] - u_block_idxs[i];
+      if (block_diff == 0) {
+        u_min_idxs[i] = v_min_idxs[i] = sub_block_query(u_block_idxs[i], u_offset, v_offset);
+      } else {
+        // u's block comes before v's, so it can't be the (possibly
+        // short) last block.
+        u_min_idxs[i] = sub_block_query(u_block_idxs[i], u_offset, bs - 1);
+        v_min_idxs[i] = sub_block_query(v_block_idxs[i], 0, v_offset);
+        prefetch(&val(u_min_idxs[i]));
+        prefetch(&val(v_min_idxs[i]));
+        if (block_diff > 1) {
+          super_uos[super_count] = u_block_idxs[i] + 1;
+          super_vos[super_count] = v_block_idxs[i];
+          ++super_count;
         }
       }
     }
+
+    difference_type super_idxs[rmq_base::chunk_size];
+    if (super_count > 0) {
+      _super_rmq->query_chunk(super_uos, super_vos, super_count, super_idxs);
+    }
+
+    // Finally, combine the pieces of each query, in the same order we
+    // gathered the super array queries.
+    size_t super_i = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const difference_type block_diff = v_block_idxs[i] - u_block_idxs[i];
+      if (block_diff == 0) {
+        RMQ_COUNT("pm_rmq.query.same_block");
+        out[i] = u_min_idxs[i];
+      } else if (block_diff == 1) {
+        RMQ_COUNT("pm_rmq.query.adjacent_blocks");
+        out[i] = val(u_min_idxs[i]) < val(v_min_idxs[i]) ? u_min_idxs[i] : v_min_idxs[i];
+      } else {
+        RMQ_COUNT("pm_rmq.query.super_array");
+        out[i] = combine(u_min_idxs[i], v_min_idxs[i], super_idxs[super_i++]);
+      }
+    }
   }
 };
@@ -7,10 +7,12 @@
 #include <assert.h>
 
 #include <algorithm>
-#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <iostream>
 #include <iterator>
+#include <utility>
 #include <vector>
 
 namespace rmq_test {
@@ -54,16 +56,11 @@ namespace rmq_test {
     for (std::vector<int>::iterator it = input.begin() + 1; it != input.end(); ++it) {
       *it = *(it - 1) + ((std::rand() % 2 == 0) ? -1 : 1);
     }
-    auto t0 = std::chrono::high_resolution_clock::now();
     impl im(input.begin(), input.end());
-    auto t1 = std::chrono::high_resolution_clock::now();
-
-    std::chrono::microseconds elapsed = std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0);
-    std::cout << "built in " << elapsed.count() << "us" << std::endl;
 
     size_t K = 100;
     for (size_t i = 0; i < N - K; ++i) {
-      size_t len = std::max(size_t(1), size_t(std::abs(std::rand() % K)));
+      size_t len = std::max(size_t(1), size_t(std::rand()) % K);
       std::vector<int>::const_iterator expected = std::min_element(input.begin() + i, input.begin() + i + len);
       std::vector<int>::difference_type found = im.query(input.begin() + i, input.begin() + i + len);
       if (*expected != input[found]) {
@@ -75,13 +72,90 @@ namespace rmq_test {
       }
       assert(*expected == input[found]);
     }
+
+    // Run the same kind of queries through query_batch, and check that it
+    // agrees with query.
+    typedef std::vector<int>::difference_type difference_type;
+    std::vector<std::pair<difference_type, difference_type> > queries;
+    for (size_t i = 0; i < N - K; ++i) {
+      size_t len = std::max(size_t(1), size_t(std::rand()) % K);
+      queries.push_back(std::make_pair(difference_type(i), difference_type(i + len)));
+    }
+    std::vector<difference_type> answers;
+    im.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+    assert(answers.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      assert(answers[i] == im.query_offset(queries[i].first, queries[i].second));
+    }
+
+    // Every implementation keeps some tables, and names their parts.
+    assert(im.bytes_used() > 0);
+    const memory_breakdown usage = im.memory_usage();
+    for (const memory_breakdown::component &c : usage.components()) {
+      assert(!c.first.empty());
+    }
+  }
+
+  /**
+   * Checks that building with several threads gives exactly the same
+   * answers as building with one.
+   */
+  template<typename impl>
+  void threaded_test(size_t N = 1000000, unsigned threads = 4) {
+    std::vector<int> input(N);
+    input[0] = 0;
+    for (std::vector<int>::iterator it = input.begin() + 1; it != input.end(); ++it) {
+      *it = *(it - 1) + ((std::rand() % 2 == 0) ? -1 : 1);
+    }
+    impl serial(input.begin(), input.end());
+    impl parallel(input.begin(), input.end(), threads);
+
+    typedef std::vector<int>::difference_type difference_type;
+    std::vector<std::pair<difference_type, difference_type> > queries;
+    for (size_t i = 0; i < 100000; ++i) {
+      size_t u = size_t(std::rand()) % N;
+      size_t v = u + 1 + size_t(std::rand()) % (N - u);
+      queries.push_back(std::make_pair(difference_type(u), difference_type(v)));
+    }
+    std::vector<difference_type> serial_answers;
+    std::vector<difference_type> parallel_answers;
+    serial.query_batch(queries.begin(), queries.end(), std::back_inserter(serial_answers));
+    parallel.query_batch(queries.begin(), queries.end(), std::back_inserter(parallel_answers));
+    assert(serial_answers == parallel_answers);
   }
 
 }
 
+// The bodies of the test programs below.
+#define RMQ_TEST_BODY(impl)                                             \
+  rmq_test::test<impl<int *>>();                                        \
+  rmq_test::vector_test<impl<std::vector<int>::const_iterator>>()
+
+#define RMQ_NARROW_TEST_BODY(impl)                                      \
+  rmq_test::test<impl<int *, int, std::ptrdiff_t, uint32_t>>();         \
+  rmq_test::vector_test<impl<std::vector<int>::const_iterator,          \
+                             int, std::ptrdiff_t, uint32_t>>()
+
 #define TEST_IMPL(impl)                                                 \
   int main(int argc, const char *argv[]) {                              \
-    rmq_test::test<impl<int *>>();                                      \
-    rmq_test::vector_test<impl<std::vector<int>::const_iterator>>();    \
+    RMQ_TEST_BODY(impl);                                                \
+    return 0;                                                           \
+  }
+
+// Also runs the tests with the implementation's index_type narrowed to
+// uint32_t.
+#define TEST_NARROW_IMPL(impl)                                          \
+  int main(int argc, const char *argv[]) {                              \
+    RMQ_TEST_BODY(impl);                                                \
+    RMQ_NARROW_TEST_BODY(impl);                                         \
+    return 0;                                                           \
+  }
+
+// Also checks that a multi-threaded build gives the same answers.
+#define TEST_THREADED_IMPL(impl)                                        \
+  int main(int argc, const char *argv[]) {                              \
+    RMQ_TEST_BODY(impl);                                                \
+    RMQ_NARROW_TEST_BODY(impl);                                         \
+    rmq_test::threaded_test<impl<std::vector<int>::const_iterator>>();  \
     return 0;                                                           \
   }
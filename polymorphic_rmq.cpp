@@ -0,0 +1,8 @@
+#include "polymorphic_rmq.hpp"
+#include "sparse_rmq.hpp"
+#include "rmq_test.hpp"
+
+template<typename iterator_type>
+using polymorphic_sparse_rmq = rmq_adapter<sparse_rmq<iterator_type>, iterator_type>;
+
+TEST_IMPL(polymorphic_sparse_rmq)
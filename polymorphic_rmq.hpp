@@ -0,0 +1,93 @@
+/**
+ * A runtime-polymorphic version of the RMQ interface, for callers that
+ * need to choose an implementation at runtime (the rmq interface itself
+ * is statically dispatched).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+#include "rmq.hpp"
+
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  >
+class polymorphic_rmq {
+
+public:
+  static const size_t chunk_size = rmq_chunk_size;
+
+  virtual ~polymorphic_rmq() {}
+
+  /**
+   * See rmq.
+   */
+  virtual difference_type query(iterator_type u, iterator_type v) const = 0;
+
+  virtual difference_type query_offset(difference_type uo, difference_type vo) const = 0;
+
+  virtual void query_chunk(const difference_type *uos, const difference_type *vos,
+                           size_t count, difference_type *out) const = 0;
+
+  virtual memory_breakdown memory_usage() const = 0;
+
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * See rmq::query_batch.  There's one virtual call per chunk, rather
+   * than per query.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    return query_batch_in_chunks<difference_type>(*this, first, last, out);
+  }
+};
+
+/**
+ * Wraps an RMQ implementation impl (for example,
+ * sparse_rmq<iterator_type>) in the polymorphic_rmq interface.  The
+ * implementation is constructed in place, since some implementations
+ * hold pointers into themselves and can't be moved.
+ */
+template<
+  typename impl,
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  >
+class rmq_adapter : public polymorphic_rmq<iterator_type, value_type, difference_type> {
+
+  impl _impl;
+
+public:
+  rmq_adapter(iterator_type b, iterator_type e)
+    : _impl(b, e)
+  {}
+
+  difference_type query(iterator_type u, iterator_type v) const {
+    return _impl.query(u, v);
+  }
+
+  difference_type query_offset(difference_type uo, difference_type vo) const {
+    return _impl.query_offset(uo, vo);
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    _impl.query_chunk(uos, vos, count, out);
+  }
+
+  memory_breakdown memory_usage() const {
+    return _impl.memory_usage();
+  }
+};
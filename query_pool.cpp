@@ -0,0 +1,83 @@
+#include <assert.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "opt_rmq.hpp"
+#include "query_pool.hpp"
+#include "sparse_rmq.hpp"
+
+typedef std::vector<int>::const_iterator iterator_type;
+typedef std::vector<int>::difference_type difference_type;
+typedef std::pair<difference_type, difference_type> query_type;
+
+std::vector<query_type> random_queries(size_t count, size_t n) {
+  std::vector<query_type> queries;
+  for (size_t i = 0; i < count; ++i) {
+    const size_t u = size_t(std::rand()) % n;
+    const size_t v = u + 1 + size_t(std::rand()) % (n - u);
+    queries.push_back(std::make_pair(difference_type(u), difference_type(v)));
+  }
+  return queries;
+}
+
+/**
+ * Checks that pool answers batches of every size the same as impl
+ * answers them itself.
+ */
+template<typename impl>
+void pool_test(query_pool &pool, const impl &im, size_t n) {
+  for (size_t count : {size_t(0), size_t(1), size_t(100), size_t(5000), size_t(200000)}) {
+    const std::vector<query_type> queries = random_queries(count, n);
+    std::vector<difference_type> expected;
+    im.query_batch(queries.begin(), queries.end(), std::back_inserter(expected));
+
+    std::vector<difference_type> answers(count, -1);
+    // A small grain, so that even the smaller batches are sharded.
+    auto end = pool.query_batch(im, queries.begin(), queries.end(), answers.begin(), 64);
+    assert(end == answers.end());
+    assert(answers == expected);
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  std::vector<int> input(100000);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+  const sparse_rmq<iterator_type, int, difference_type, uint32_t> sparse(input.begin(), input.end());
+  const opt_rmq<iterator_type> opt(input.begin(), input.end());
+
+  for (unsigned threads : {1u, 2u, 4u}) {
+    query_pool pool(threads);
+    assert(pool.threads() == threads);
+    pool_test(pool, sparse, input.size());
+    pool_test(pool, opt, input.size());
+  }
+
+  {
+    // Batches from several threads at once take turns.
+    query_pool pool(3);
+    const std::vector<query_type> queries = random_queries(100000, input.size());
+    std::vector<difference_type> expected;
+    sparse.query_batch(queries.begin(), queries.end(), std::back_inserter(expected));
+    std::vector<std::vector<difference_type> > answers(4, std::vector<difference_type>(queries.size()));
+    std::vector<std::thread> callers;
+    for (size_t i = 0; i < answers.size(); ++i) {
+      callers.push_back(std::thread([&pool, &sparse, &queries, &answers, i]() {
+            pool.query_batch(sparse, queries.begin(), queries.end(), answers[i].begin());
+          }));
+    }
+    for (std::thread &t : callers) {
+      t.join();
+    }
+    for (const std::vector<difference_type> &a : answers) {
+      assert(a == expected);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+/**
+ * A pool of threads for answering large batches of queries against one
+ * implementation in parallel.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rmq.hpp"
+
+/**
+ * Every implementation's queries are const and read nothing but its
+ * tables and the input, so once it's built any number of threads can
+ * query it at once (see rmq.hpp).  query_pool makes use of that: its
+ * query_batch splits a batch into shards, which the pool's threads and
+ * the calling one take in turn and answer with the implementation's own
+ * query_batch, writing each shard's answers to its part of the output,
+ * so they come out in order.
+ *
+ * Unlike parallel_for, which starts threads for each construction, the
+ * threads are started once, with the pool, and wait between batches, so
+ * that a program issuing many batches doesn't pay for starting threads
+ * for each.
+ *
+ * Shards are many more than the threads and are handed out as threads
+ * finish their last, so that threads that get slower shards (of longer
+ * queries, say, or on a busier core) don't hold up the rest.  Batches
+ * too small for more than one shard are answered on the calling thread
+ * without waking the pool.
+ *
+ * One pool can be shared between threads, but it answers one batch at a
+ * time: a query_batch called while another is running waits for it.
+ */
+class query_pool {
+  std::vector<std::thread> _workers;
+
+  /**
+   * Guards everything below but _next_shard, and is what the workers
+   * wait on for a batch.
+   */
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  std::condition_variable _done;
+  bool _stopping;
+
+  /**
+   * Counts batches, so that a worker can tell a new one from the one it
+   * last worked on.
+   */
+  uint64_t _generation;
+
+  /**
+   * The batch being answered: run_shard(s) answers shard s of shards.
+   */
+  std::function<void(size_t)> _run_shard;
+  size_t _shards;
+  std::atomic<size_t> _next_shard;
+
+  /**
+   * The workers that haven't finished with the current batch, which has
+   * to stay put until they have.
+   */
+  size_t _busy;
+
+  /**
+   * Held by query_batch for the whole of a batch.
+   */
+  std::mutex _batch_mutex;
+
+  void take_shards() {
+    for (size_t s; (s = _next_shard.fetch_add(1)) < _shards;) {
+      _run_shard(s);
+    }
+  }
+
+  void work() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (;;) {
+      _wake.wait(lock, [this, seen]() { return _stopping || _generation != seen; });
+      if (_stopping) {
+        return;
+      }
+      seen = _generation;
+      lock.unlock();
+      take_shards();
+      lock.lock();
+      if (--_busy == 0) {
+        _done.notify_one();
+      }
+    }
+  }
+
+public:
+  /**
+   * A pool answering batches on up to threads threads, including the
+   * one calling query_batch, so it starts threads - 1 of its own.
+   */
+  explicit query_pool(unsigned threads = std::max(1u, std::thread::hardware_concurrency()))
+    : _stopping(false),
+      _generation(0),
+      _shards(0),
+      _next_shard(0),
+      _busy(0)
+  {
+    for (unsigned i = 1; i < threads; ++i) {
+      _workers.push_back(std::thread([this]() { work(); }));
+    }
+  }
+
+  query_pool(const query_pool &) = delete;
+  query_pool &operator=(const query_pool &) = delete;
+
+  ~query_pool() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+    }
+    _wake.notify_all();
+    for (std::thread &t : _workers) {
+      t.join();
+    }
+  }
+
+  /**
+   * The number of threads batches are answered on.
+   */
+  unsigned threads() const { return unsigned(_workers.size()) + 1; }
+
+  /**
+   * Answers the queries in [first, last) on impl, like impl.query_batch
+   * (first, last, out) does, but spread across the pool's threads, and
+   * returns the end of the answers.  Unlike impl.query_batch's, first
+   * and out have to be random access, so that shards can start anywhere.
+   *
+   * Shards are made no smaller than min_grain queries (rounded up to a
+   * whole number of chunks), so that handing one out is cheap next to
+   * answering it.
+   */
+  template<
+    typename impl_type,
+    typename RandomAccessIterator,
+    typename RandomAccessOutputIterator
+    >
+  RandomAccessOutputIterator query_batch(const impl_type &impl,
+                                         RandomAccessIterator first, RandomAccessIterator last,
+                                         RandomAccessOutputIterator out,
+                                         size_t min_grain = 4096) {
+    const size_t len = size_t(std::distance(first, last));
+    // A few shards per thread, to balance the load.
+    size_t grain = std::max(min_grain, len / (8 * threads()) + 1);
+    grain = (grain + rmq_chunk_size - 1) / rmq_chunk_size * rmq_chunk_size;
+    const size_t shards = (len + grain - 1) / grain;
+    if (shards <= 1 || _workers.empty()) {
+      impl.query_batch(first, last, out);
+      return out + len;
+    }
+
+    std::lock_guard<std::mutex> batch(_batch_mutex);
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _run_shard = [&impl, first, out, len, grain](size_t s) {
+        const size_t lo = s * grain;
+        const size_t hi = std::min(len, lo + grain);
+        impl.query_batch(first + lo, first + hi, out + lo);
+      };
+      _shards = shards;
+      _next_shard = 0;
+      _busy = _workers.size();
+      ++_generation;
+    }
+    _wake.notify_all();
+    take_shards();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _busy == 0; });
+    _run_shard = nullptr;
+    return out + len;
+  }
+};
@@ -5,9 +5,163 @@
 
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
 #include <iterator>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
 
+/**
+ * The number of queries query_batch hands to query_chunk at a time.  This
+ * is about how many outstanding misses we want to overlap, and small
+ * enough for the per-chunk scratch arrays to live on the stack.
+ */
+const size_t rmq_chunk_size = 64;
+
+/**
+ * floor(log_2(x)) computed with an integer bit scan.
+ *
+ * Preconditions:
+ *  x > 0
+ */
+template<typename difference_type>
+difference_type rmq_lg(difference_type x) {
+  return difference_type(8 * sizeof(unsigned long long) - 1 -
+                         __builtin_clzll((unsigned long long) x));
+}
+
+/**
+ * Hints that we'll soon read from p, so batched queries can have many
+ * cache misses in flight at once.
+ */
+inline void rmq_prefetch(const void *p) {
+  __builtin_prefetch(p);
+}
+
+/**
+ * Answers the queries in [first, last), which should be a range of
+ * (uo, vo) pairs of offsets, by handing them to impl.query_chunk
+ * rmq_chunk_size at a time, and writes the answers to out, in order.
+ */
+template<
+  typename difference_type,
+  typename impl_type,
+  typename InputIterator,
+  typename OutputIterator
+  >
+OutputIterator query_batch_in_chunks(const impl_type &impl,
+                                     InputIterator first, InputIterator last,
+                                     OutputIterator out) {
+  difference_type uos[rmq_chunk_size];
+  difference_type vos[rmq_chunk_size];
+  difference_type answers[rmq_chunk_size];
+  while (first != last) {
+    size_t count = 0;
+    for (; count < rmq_chunk_size && first != last; ++count, ++first) {
+      uos[count] = std::get<0>(*first);
+      vos[count] = std::get<1>(*first);
+    }
+    impl.query_chunk(uos, vos, count, answers);
+    out = std::copy(answers, answers + count, out);
+  }
+  return out;
+}
+
+/**
+ * How much memory an implementation holds, broken down by component so
+ * that it can be exported as metrics.  Components are named after what
+ * they hold ("levels", "super_array"), and those of a nested
+ * implementation are prefixed with its name and a dot
+ * ("super_rmq.levels").
+ *
+ * Sizes count the arrays an implementation keeps (at their capacity),
+ * but not the small fixed-size objects holding them.  Tables loaded from
+ * an index file (see serialize.hpp) are views of the mapped file rather
+ * than allocations, and count as nothing.
+ */
+class memory_breakdown {
+public:
+  typedef std::pair<std::string, size_t> component;
+
+private:
+  std::vector<component> _components;
+
+public:
+  void add(const std::string &name, size_t bytes) {
+    _components.push_back(component(name, bytes));
+  }
+
+  /**
+   * Adds part's components, as the parts of name.
+   */
+  void add(const std::string &name, const memory_breakdown &part) {
+    for (const component &c : part._components) {
+      add(name + "." + c.first, c.second);
+    }
+  }
+
+  const std::vector<component> &components() const { return _components; }
+
+  size_t total() const {
+    size_t bytes = 0;
+    for (const component &c : _components) {
+      bytes += c.second;
+    }
+    return bytes;
+  }
+};
+
+/**
+ * The bytes allocated for v's elements.
+ */
+template<typename T, typename Allocator>
+size_t vector_bytes(const std::vector<T, Allocator> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+/**
+ * The interface is statically dispatched: derived_type is the
+ * implementation inheriting from rmq (the "curiously recurring template
+ * pattern"), so that calls between composed implementations (like
+ * pm_rmq's queries on its sparse_rmq, or lca's on its ±1 RMQ) can be
+ * inlined.  See polymorphic_rmq.hpp for an adapter to use when the
+ * implementation has to be chosen at runtime.
+ *
+ * derived_type must provide:
+ *
+ *   difference_type query(iterator_type u, iterator_type v) const;
+ *
+ * which queries for the index of the minimum value between u and v.
+ *
+ * Preconditions:
+ *  b <= u <= v <= e
+ *
+ * and
+ *
+ *   memory_breakdown memory_usage() const;
+ *
+ * which reports the memory it holds (see memory_breakdown).
+ *
+ * It may also provide its own query_chunk (see below).
+ *
+ * Queries, which are const, must not write to anything: once an
+ * implementation is constructed, any number of threads can query it at
+ * once, without locking, as long as nothing writes to its input (see
+ * query_pool.hpp for spreading a batch across threads).  None of the
+ * implementations keep mutable state, caches included, and the ones
+ * that can change (dynamic_rmq and window_rmq) need their updates
+ * serialized with their queries as usual.
+ *
+ * The one exception is instrumentation (see instrument.hpp): built with
+ * RMQ_INSTRUMENT, queries add to process-wide counters and histograms,
+ * and the first at each call site looks its counter up under a lock.
+ * Those writes are atomic, so concurrent queries are still safe, but
+ * they contend for the counters' cache lines.
+ */
 template<
+  typename derived_type,
   typename iterator_type,
   typename value_type=typename std::iterator_traits<iterator_type>::value_type,
   typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
@@ -25,6 +179,10 @@ class rmq {
    */
   const iterator_type _end;
 
+  const derived_type &derived() const {
+    return static_cast<const derived_type &>(*this);
+  }
+
 protected:
 
   iterator_type begin() const { return _begin; }
@@ -41,7 +199,20 @@ protected:
    */
   const value_type &val(difference_type i) const { return _begin[i]; }
 
+  /**
+   * Shorthands for rmq_lg and rmq_prefetch.
+   */
+  static difference_type lg(difference_type x) {
+    return rmq_lg(x);
+  }
+
+  static void prefetch(const void *p) {
+    rmq_prefetch(p);
+  }
+
 public:
+  static const size_t chunk_size = rmq_chunk_size;
+
   rmq() = delete;
 
   /**
@@ -52,14 +223,6 @@ public:
       _end(e)
   {}
 
-  /**
-   * Query for the index of the minimum value between u and v.
-   *
-   * Preconditions:
-   *  b <= u <= v <= e
-   */
-  virtual difference_type query(iterator_type u, iterator_type v) const = 0;
-
   /**
    * Same query but using integer offsets from _begin rather than
    * iterators.
@@ -68,6 +231,46 @@ public:
    *  0 <= u <= v <= n().
    */
   difference_type query_offset(difference_type uo, difference_type vo) const {
-    return query(begin() + uo, begin() + vo);
+    return derived().query(begin() + uo, begin() + vo);
+  }
+
+  /**
+   * The total of memory_usage().
+   */
+  size_t bytes_used() const {
+    return derived().memory_usage().total();
+  }
+
+  /**
+   * Answers the queries in [first, last), which should be a range of
+   * (uo, vo) pairs of offsets like those passed to query_offset, and
+   * writes the answers to out, in order.
+   *
+   * Queries are handed to query_chunk chunk_size at a time, so that
+   * implementations can overlap the memory latency of independent
+   * queries.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    return query_batch_in_chunks<difference_type>(derived(), first, last, out);
+  }
+
+  /**
+   * Answers count (at most chunk_size) queries, the ith of which is
+   * query_offset(uos[i], vos[i]), writing the ith answer to out[i].
+   *
+   * The default just runs each query in turn, implementations hide this
+   * with their own versions that interleave the queries' memory
+   * accesses.
+   */
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = query_offset(uos[i], vos[i]);
+    }
   }
 };
@@ -0,0 +1,359 @@
+/**
+ * Benchmarks the RMQ implementations over a range of input sizes, input
+ * distributions and query lengths, and prints the results as CSV.
+ *
+ * Usage:
+ *
+ *   rmq_bench [--min-n N] [--max-n N] [--queries Q]
+ *             [--engines a,b,...] [--inputs a,b,...] [--lengths a,b,...]
+ *
+ * Sizes go from --min-n to --max-n (by default 1K to 4M), multiplying by
+ * 4 each time.  Every engine is built over every input distribution:
+ *
+ *   random      uniform values in [0, 2^30)
+ *   sorted      0, 1, 2, ...
+ *   pm1         a random walk of ±1 steps, the only input pm_rmq takes
+ *   duplicates  uniform values in [0, 16)
+ *
+ * and then answers --queries queries (by default 1M) of each length
+ * distribution:
+ *
+ *   short    [u, u + len) with len uniform in [1, 64]
+ *   long     len uniform in [n/2, n]
+ *   uniform  u and v uniform over the whole input
+ *
+ * The columns are the engine, the input distribution, n, the length
+ * distribution, the number of queries, the build time in milliseconds,
+ * the time per query for query_offset called in a loop and for
+ * query_batch, the resulting batched queries per second, and the bytes
+ * allocated by the engine per element of input (not counting the input
+ * itself).
+ *
+ * naive_rmq takes O(n^2) space, so it's only run up to n = 4096.  The
+ * rest go as far as --max-n says, so mind the memory: sparse_rmq, for
+ * example, takes 4 lg(n) bytes per element.  Build with optimization
+ * (the default when CMAKE_BUILD_TYPE is unset) and, for the AVX2
+ * kernels, RMQ_NATIVE.
+ *
+ * sharded_rmq runs with sparse_rmq shards of the default size.
+ * matrix_rmq isn't here: its input is a matrix and its queries are
+ * rectangles, so none of the input or length distributions above apply
+ * to it.
+ */
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "block_rmq.hpp"
+#include "dynamic_rmq.hpp"
+#include "naive_rmq.hpp"
+#include "opt_rmq.hpp"
+#include "pm_rmq.hpp"
+#include "sharded_rmq.hpp"
+#include "sparse_rmq.hpp"
+#include "succinct_rmq.hpp"
+
+/**
+ * Bytes currently allocated through operator new, by malloc's reckoning,
+ * so that an engine's footprint is however much more there is after
+ * building it than before.  The benchmark is single threaded.
+ */
+static size_t live_bytes = 0;
+
+// Allocating and freeing go through these, kept out of line so that the
+// compiler doesn't inline free() into code it knows got its pointer from
+// operator new, and warn that they don't match.
+__attribute__((noinline)) static void *allocate(size_t size) {
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  live_bytes += malloc_usable_size(p);
+  return p;
+}
+
+__attribute__((noinline)) static void release(void *p) noexcept {
+  if (p) {
+    live_bytes -= malloc_usable_size(p);
+    std::free(p);
+  }
+}
+
+void *operator new(size_t size) {
+  return allocate(size);
+}
+
+void *operator new[](size_t size) {
+  return allocate(size);
+}
+
+void operator delete(void *p) noexcept {
+  release(p);
+}
+
+void operator delete[](void *p) noexcept {
+  release(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  release(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  release(p);
+}
+
+namespace {
+
+  typedef std::vector<int>::const_iterator iterator_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef std::pair<difference_type, difference_type> query_type;
+
+  /**
+   * Indexes are stored in 32 bits, which holds offsets into inputs of up
+   * to 4G elements and is what you'd pick in practice.
+   */
+  typedef uint32_t index_type;
+
+  typedef std::chrono::steady_clock clock_type;
+
+  double elapsed_ns(clock_type::time_point t0, clock_type::time_point t1) {
+    return std::chrono::duration<double, std::nano>(t1 - t0).count();
+  }
+
+  struct options {
+    size_t min_n = 1 << 10;
+    size_t max_n = 1 << 22;
+    size_t queries = 1000000;
+    std::vector<std::string> engines;
+    std::vector<std::string> inputs;
+    std::vector<std::string> lengths;
+  };
+
+  /**
+   * Whether name was selected by a --engines, --inputs or --lengths list
+   * (an empty list selects everything).
+   */
+  bool selected(const std::vector<std::string> &list, const std::string &name) {
+    return list.empty() || std::find(list.begin(), list.end(), name) != list.end();
+  }
+
+  std::vector<std::string> split(const char *s) {
+    std::vector<std::string> parts;
+    std::string part;
+    for (; *s; ++s) {
+      if (*s == ',') {
+        parts.push_back(part);
+        part.clear();
+      } else {
+        part += *s;
+      }
+    }
+    parts.push_back(part);
+    return parts;
+  }
+
+  std::vector<int> make_input(const std::string &input, size_t n, std::mt19937_64 &rng) {
+    std::vector<int> values(n);
+    if (input == "random") {
+      for (size_t i = 0; i < n; ++i) {
+        values[i] = int(rng() % (1 << 30));
+      }
+    } else if (input == "sorted") {
+      for (size_t i = 0; i < n; ++i) {
+        values[i] = int(i);
+      }
+    } else if (input == "pm1") {
+      for (size_t i = 1; i < n; ++i) {
+        values[i] = values[i - 1] + (rng() % 2 ? 1 : -1);
+      }
+    } else {
+      for (size_t i = 0; i < n; ++i) {
+        values[i] = int(rng() % 16);
+      }
+    }
+    return values;
+  }
+
+  std::vector<query_type> make_queries(const std::string &lengths, size_t n, size_t count,
+                                       std::mt19937_64 &rng) {
+    std::vector<query_type> queries(count);
+    for (size_t i = 0; i < count; ++i) {
+      difference_type u, v;
+      if (lengths == "uniform") {
+        u = rng() % n;
+        v = rng() % n;
+        if (v < u) {
+          std::swap(u, v);
+        }
+        ++v;
+      } else {
+        const size_t min_len = lengths == "short" ? 1 : std::max(size_t(1), n / 2);
+        const size_t max_len = lengths == "short" ? std::min(size_t(64), n) : n;
+        const size_t len = min_len + rng() % (max_len - min_len + 1);
+        u = rng() % (n - len + 1);
+        v = u + len;
+      }
+      queries[i] = query_type(u, v);
+    }
+    return queries;
+  }
+
+  const char *const input_names[] = {"random", "sorted", "pm1", "duplicates"};
+  const char *const length_names[] = {"short", "long", "uniform"};
+
+  /**
+   * Keeps the compiler from discarding the queries' answers.
+   */
+  volatile difference_type sink;
+
+  /**
+   * Builds impl over values and times it, repeating small builds until
+   * they've taken long enough to time, then times each kind of query on
+   * the last one.
+   */
+  template<typename impl>
+  void run(const options &opts, const char *engine, const std::string &input,
+           const std::vector<int> &values, std::mt19937_64 &rng) {
+    const size_t n = values.size();
+    std::unique_ptr<impl> im;
+    double build_ns = 0;
+    size_t bytes = 0;
+    size_t builds = 0;
+    do {
+      im.reset();
+      const size_t before = live_bytes;
+      const clock_type::time_point t0 = clock_type::now();
+      im.reset(new impl(values.begin(), values.end()));
+      const clock_type::time_point t1 = clock_type::now();
+      bytes = live_bytes - before;
+      build_ns += elapsed_ns(t0, t1);
+      ++builds;
+    } while (build_ns < 1e8 && builds < 100);
+
+    for (const char *lengths : length_names) {
+      if (!selected(opts.lengths, lengths)) {
+        continue;
+      }
+      const std::vector<query_type> queries = make_queries(lengths, n, opts.queries, rng);
+
+      difference_type sum = 0;
+      const clock_type::time_point t0 = clock_type::now();
+      for (const query_type &q : queries) {
+        sum += im->query_offset(q.first, q.second);
+      }
+      const clock_type::time_point t1 = clock_type::now();
+      sink = sum;
+
+      std::vector<difference_type> answers(queries.size());
+      const clock_type::time_point t2 = clock_type::now();
+      im->query_batch(queries.begin(), queries.end(), answers.begin());
+      const clock_type::time_point t3 = clock_type::now();
+      sink = answers.empty() ? 0 : answers.back();
+
+      const double query_ns = elapsed_ns(t0, t1) / queries.size();
+      const double batch_ns = elapsed_ns(t2, t3) / queries.size();
+      std::printf("%s,%s,%zu,%s,%zu,%.3f,%.2f,%.2f,%.0f,%.2f\n",
+                  engine, input.c_str(), n, lengths, queries.size(),
+                  build_ns / builds / 1e6, query_ns, batch_ns, 1e9 / batch_ns,
+                  double(bytes) / n);
+      std::fflush(stdout);
+    }
+  }
+
+  struct engine {
+    const char *name;
+    void (*run)(const options &, const char *, const std::string &,
+                const std::vector<int> &, std::mt19937_64 &);
+    bool pm1_only;
+    size_t max_n;
+  };
+
+  const size_t unlimited = size_t(-1);
+
+  const engine engines[] = {
+    {"naive_rmq", run<naive_rmq<iterator_type, int, difference_type, index_type>>, false, 4096},
+    {"sparse_rmq", run<sparse_rmq<iterator_type, int, difference_type, index_type>>, false, unlimited},
+    {"value_sparse_rmq", run<sparse_rmq<iterator_type, int, difference_type, index_type, true>>, false, unlimited},
+    {"pm_rmq", run<pm_rmq<iterator_type, int, difference_type, index_type>>, true, unlimited},
+    {"opt_rmq", run<opt_rmq<iterator_type, int, difference_type, index_type>>, false, unlimited},
+    {"succinct_rmq", run<succinct_rmq<iterator_type>>, false, unlimited},
+    {"block_rmq", run<block_rmq<iterator_type, int, difference_type, index_type>>, false, unlimited},
+    {"sharded_rmq", run<sharded_rmq<iterator_type, sparse_rmq<iterator_type, int, difference_type, index_type>,
+                                    int, difference_type, index_type>>, false, unlimited},
+    {"dynamic_rmq", run<dynamic_rmq<int, difference_type, index_type>>, false, unlimited},
+  };
+
+  void usage(const char *argv0) {
+    std::fprintf(stderr,
+                 "usage: %s [--min-n N] [--max-n N] [--queries Q]\n"
+                 "       [--engines a,b,...] [--inputs a,b,...] [--lengths a,b,...]\n",
+                 argv0);
+    std::exit(2);
+  }
+
+}
+
+int main(int argc, const char *argv[]) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 == argc) {
+      usage(argv[0]);
+    }
+    const char *arg = argv[i++];
+    if (std::strcmp(arg, "--min-n") == 0) {
+      opts.min_n = std::strtoull(argv[i], nullptr, 0);
+    } else if (std::strcmp(arg, "--max-n") == 0) {
+      opts.max_n = std::strtoull(argv[i], nullptr, 0);
+    } else if (std::strcmp(arg, "--queries") == 0) {
+      opts.queries = std::strtoull(argv[i], nullptr, 0);
+    } else if (std::strcmp(arg, "--engines") == 0) {
+      opts.engines = split(argv[i]);
+    } else if (std::strcmp(arg, "--inputs") == 0) {
+      opts.inputs = split(argv[i]);
+    } else if (std::strcmp(arg, "--lengths") == 0) {
+      opts.lengths = split(argv[i]);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (opts.min_n == 0 || opts.max_n < opts.min_n || opts.queries == 0) {
+    usage(argv[0]);
+  }
+
+  std::printf("engine,input,n,lengths,queries,build_ms,ns_per_query,"
+              "ns_per_batch_query,batch_queries_per_s,bytes_per_element\n");
+  std::mt19937_64 rng(42);
+  for (size_t n = opts.min_n; n <= opts.max_n; n *= 4) {
+    for (const char *input : input_names) {
+      if (!selected(opts.inputs, input)) {
+        continue;
+      }
+      const std::vector<int> values = make_input(input, n, rng);
+      for (const engine &e : engines) {
+        if (!selected(opts.engines, e.name) || n > e.max_n ||
+            (e.pm1_only && std::strcmp(input, "pm1") != 0)) {
+          continue;
+        }
+        e.run(opts, e.name, input, values, rng);
+      }
+    }
+    if (n > opts.max_n / 4) {
+      break;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,171 @@
+#include <assert.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "block_rmq.hpp"
+#include "opt_rmq.hpp"
+#include "pm_rmq.hpp"
+#include "serialize.hpp"
+#include "sparse_rmq.hpp"
+
+typedef std::vector<int>::const_iterator iterator_type;
+typedef std::vector<int>::difference_type difference_type;
+
+static const char *path = "serialize_test.idx";
+
+template<typename impl>
+void save(const impl &im) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  index_writer writer(out);
+  im.save(writer);
+}
+
+/**
+ * Checks that impl loaded from the index it saved for input gives the
+ * same answers as the impl it was saved from.
+ */
+template<typename impl>
+void round_trip_test(const std::vector<int> &input) {
+  std::vector<std::pair<difference_type, difference_type> > queries;
+  for (size_t i = 0; i < 100000; ++i) {
+    const size_t u = size_t(std::rand()) % input.size();
+    const size_t v = u + 1 + size_t(std::rand()) % (input.size() - u);
+    queries.push_back(std::make_pair(difference_type(u), difference_type(v)));
+  }
+
+  std::vector<difference_type> built_answers;
+  size_t built_bytes;
+  {
+    impl built(input.begin(), input.end());
+    save(built);
+    built.query_batch(queries.begin(), queries.end(), std::back_inserter(built_answers));
+    built_bytes = built.bytes_used();
+  }
+
+  index_reader reader(path);
+  impl loaded(input.begin(), input.end(), reader);
+  // The loaded tables are views of the mapping, not allocations.
+  assert(loaded.bytes_used() < built_bytes / 2);
+  std::vector<difference_type> loaded_answers;
+  loaded.query_batch(queries.begin(), queries.end(), std::back_inserter(loaded_answers));
+  assert(loaded_answers == built_answers);
+  for (size_t i = 0; i < 1000; ++i) {
+    assert(loaded.query_offset(queries[i].first, queries[i].second) == built_answers[i]);
+  }
+}
+
+/**
+ * The bytes im saves.
+ */
+template<typename impl>
+std::string saved_bytes(const impl &im) {
+  std::ostringstream out;
+  index_writer writer(out);
+  im.save(writer);
+  return out.str();
+}
+
+/**
+ * Checks that a sparse_rmq with values inline in cells that have padding
+ * between the value and the index saves the same bytes however it was
+ * built: in memory that held other bytes before, or from an arena.
+ */
+void padding_test() {
+  typedef std::vector<int64_t>::const_iterator wide_iterator;
+  typedef sparse_rmq<wide_iterator, int64_t, difference_type, uint32_t, true> impl;
+  std::vector<int64_t> input(500);
+  for (std::vector<int64_t>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+
+  const std::string expected = saved_bytes(impl(input.begin(), input.end()));
+  {
+    // Leave bytes that aren't 0 for the next build's table to land on.
+    std::vector<unsigned char> dirty(expected.size(), 0xab);
+  }
+  assert(saved_bytes(impl(input.begin(), input.end())) == expected);
+  arena storage(4096);
+  assert(saved_bytes(impl(input.begin(), input.end(), 1, &storage)) == expected);
+}
+
+/**
+ * Checks that loading impl from the index at path throws.
+ */
+template<typename impl>
+void mismatch_test(const std::vector<int> &input) {
+  bool threw = false;
+  try {
+    index_reader reader(path);
+    impl loaded(input.begin(), input.end(), reader);
+  } catch (const std::runtime_error &) {
+    threw = true;
+  }
+  assert(threw);
+}
+
+int main(int argc, const char *argv[]) {
+  std::vector<int> input(100000);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+  std::vector<int> pm_input(100000);
+  for (size_t i = 1; i < pm_input.size(); ++i) {
+    pm_input[i] = pm_input[i - 1] + ((std::rand() & 1) ? 1 : -1);
+  }
+
+  round_trip_test<sparse_rmq<iterator_type> >(input);
+  round_trip_test<sparse_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+  round_trip_test<sparse_rmq<iterator_type, int, difference_type, uint32_t, true> >(input);
+  // The values are inline in the last one saved.
+  mismatch_test<sparse_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+  round_trip_test<pm_rmq<iterator_type> >(pm_input);
+  round_trip_test<opt_rmq<iterator_type> >(input);
+  round_trip_test<opt_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+
+  {
+    // A sparse_rmq with its levels capped only loads as one with the
+    // same cap.
+    const sparse_rmq<iterator_type> capped(input.begin(), input.end(), 1, nullptr, 100);
+    save(capped);
+    index_reader reader(path);
+    const sparse_rmq<iterator_type> loaded(input.begin(), input.end(), reader, 100);
+    for (difference_type u = 0; u + 100 <= difference_type(input.size()); u += 997) {
+      assert(loaded.query_offset(u, u + 100) == capped.query_offset(u, u + 100));
+    }
+    mismatch_test<sparse_rmq<iterator_type> >(input);
+  }
+  padding_test();
+
+  round_trip_test<block_rmq<iterator_type> >(input);
+
+  // The last index saved is a block_rmq's with the default block size
+  // and index type, which nothing else should load.
+  mismatch_test<block_rmq<iterator_type, int, difference_type, difference_type, 32> >(input);
+  mismatch_test<block_rmq<iterator_type, int, difference_type, uint32_t> >(input);
+  mismatch_test<sparse_rmq<iterator_type> >(input);
+  {
+    const std::vector<int> shorter(input.begin(), input.end() - 1);
+    mismatch_test<block_rmq<iterator_type> >(shorter);
+  }
+  {
+    // A truncated file.
+    std::ifstream in(path, std::ios::binary);
+    const std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(contents.data(), contents.size() - 1);
+  }
+  mismatch_test<block_rmq<iterator_type> >(input);
+
+  std::remove(path);
+  return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * Saves implementations' precomputed tables to index files and loads
+ * them back, memory-mapped, without copying.
+ *
+ * An index file is a header followed by the implementation's tables,
+ * each one a 64-bit element count and then the elements themselves,
+ * aligned to 64 bytes from the start of the file.  Since mappings start
+ * on a page boundary, the tables are just as aligned in memory, so
+ * loaded implementations query straight from the mapped pages (and
+ * processes mapping the same file share them).  Composed implementations
+ * write their own tables and then their parts', each with its own
+ * header.
+ *
+ * The header is:
+ *
+ *   char     magic[8]     "RMQINDEX"
+ *   uint32_t version      format_version
+ *   uint32_t kind         which implementation wrote it, an index_kind
+ *   uint32_t index_size   sizeof(index_type)
+ *   uint32_t value_size   sizeof(value_type)
+ *   uint32_t value_flags  1 if value_type is floating point, 2 if signed
+ *   uint32_t reserved     0
+ *   uint64_t n            the input size
+ *   uint64_t param        block_rmq's and pm_rmq's block size, sparse_rmq's
+ *                         level cap if it has one, 0 for the rest
+ *
+ * Everything is little-endian, and saving and loading both refuse to run
+ * on big-endian hosts, where the tables couldn't be used in place.
+ * Loading checks everything in the header and every table's size
+ * against what the implementation would have built for the input it's
+ * given, and throws std::runtime_error if anything doesn't match.  It
+ * can't check that the input is the same one the index was built for.
+ */
+
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include "table.hpp"
+
+const uint32_t format_version = 1;
+
+enum class index_kind : uint32_t {
+  sparse = 1,
+  pm = 2,
+  opt = 3,
+  block = 4,
+  sparse_values = 5,
+};
+
+/**
+ * The tables are aligned to this many bytes within the file.
+ */
+const size_t table_alignment = 64;
+
+inline void check_little_endian() {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#else
+  throw std::runtime_error("RMQ index files need a little-endian host");
+#endif
+}
+
+template<typename value_type>
+uint32_t value_flags() {
+  return (std::is_floating_point<value_type>::value ? 1 : 0) |
+         (std::is_signed<value_type>::value ? 2 : 0);
+}
+
+/**
+ * Writes index files to a binary std::ostream.
+ */
+class index_writer {
+  std::ostream &_out;
+  uint64_t _pos;
+
+  void write_bytes(const void *p, size_t size) {
+    _out.write(static_cast<const char *>(p), size);
+    if (!_out) {
+      throw std::runtime_error("error writing RMQ index");
+    }
+    _pos += size;
+  }
+
+  template<typename T>
+  void write_value(T value) {
+    write_bytes(&value, sizeof value);
+  }
+
+  void pad() {
+    static const char zeros[table_alignment] = {};
+    write_bytes(zeros, (table_alignment - _pos % table_alignment) % table_alignment);
+  }
+
+public:
+  /**
+   * Writes to out, which should be positioned at the start of the file.
+   */
+  explicit index_writer(std::ostream &out)
+    : _out(out),
+      _pos(0)
+  {
+    check_little_endian();
+  }
+
+  template<typename value_type, typename index_type>
+  void write_header(index_kind kind, uint64_t n, uint64_t param = 0) {
+    pad();
+    write_bytes("RMQINDEX", 8);
+    write_value<uint32_t>(format_version);
+    write_value<uint32_t>(uint32_t(kind));
+    write_value<uint32_t>(sizeof(index_type));
+    write_value<uint32_t>(sizeof(value_type));
+    write_value<uint32_t>(value_flags<value_type>());
+    write_value<uint32_t>(0);
+    write_value<uint64_t>(n);
+    write_value<uint64_t>(param);
+  }
+
+  template<typename T>
+  void write_table(const table<T> &t) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable tables can be saved");
+    write_value<uint64_t>(t.size());
+    pad();
+    write_bytes(t.data(), t.size() * sizeof(T));
+  }
+};
+
+/**
+ * A read-only memory mapping of a whole file, unmapped when the last
+ * table viewing it goes away.
+ */
+class mapped_file {
+  const char *_data;
+  size_t _size;
+
+  static std::system_error error(const std::string &what, const std::string &path) {
+    return std::system_error(errno, std::generic_category(), what + " " + path);
+  }
+
+public:
+  explicit mapped_file(const std::string &path)
+    : _data(nullptr),
+      _size(0)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw error("can't open", path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      const std::system_error e = error("can't stat", path);
+      close(fd);
+      throw e;
+    }
+    _size = st.st_size;
+    if (_size > 0) {
+      void *p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        const std::system_error e = error("can't map", path);
+        close(fd);
+        throw e;
+      }
+      _data = static_cast<const char *>(p);
+    }
+    // The mapping outlives the descriptor.
+    close(fd);
+  }
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  ~mapped_file() {
+    if (_data) {
+      munmap(const_cast<char *>(_data), _size);
+    }
+  }
+
+  const char *data() const { return _data; }
+
+  size_t size() const { return _size; }
+};
+
+/**
+ * Reads index files from memory, usually a mapped_file.  The tables it
+ * hands out view that memory directly.
+ */
+class index_reader {
+  std::shared_ptr<const mapped_file> _file;
+  const char *_data;
+  size_t _size;
+  size_t _pos;
+
+  const char *read_bytes(size_t size) {
+    if (size > _size - _pos) {
+      throw std::runtime_error("RMQ index is truncated");
+    }
+    const char *p = _data + _pos;
+    _pos += size;
+    return p;
+  }
+
+  template<typename T>
+  T read_value() {
+    T value;
+    std::memcpy(&value, read_bytes(sizeof value), sizeof value);
+    return value;
+  }
+
+  void skip_padding() {
+    read_bytes((table_alignment - _pos % table_alignment) % table_alignment);
+  }
+
+  static void expect(bool ok, const char *what) {
+    if (!ok) {
+      throw std::runtime_error(std::string("RMQ index doesn't match: ") + what);
+    }
+  }
+
+public:
+  /**
+   * Reads the index file at path, which stays mapped for as long as the
+   * reader or any table read from it is around.
+   */
+  explicit index_reader(const std::string &path)
+    : index_reader(std::make_shared<const mapped_file>(path))
+  {}
+
+  explicit index_reader(std::shared_ptr<const mapped_file> file)
+    : _file(std::move(file)),
+      _data(_file->data()),
+      _size(_file->size()),
+      _pos(0)
+  {
+    check_little_endian();
+  }
+
+  /**
+   * Reads the size bytes at data, which should be aligned to
+   * table_alignment and outlive every table read from them.
+   */
+  index_reader(const char *data, size_t size)
+    : _data(data),
+      _size(size),
+      _pos(0)
+  {
+    check_little_endian();
+  }
+
+  /**
+   * Reads a header, checking that it's what write_header would have
+   * written with the same arguments.
+   */
+  template<typename value_type, typename index_type>
+  void read_header(index_kind kind, uint64_t n, uint64_t param = 0) {
+    skip_padding();
+    expect(std::memcmp(read_bytes(8), "RMQINDEX", 8) == 0, "not an RMQ index");
+    expect(read_value<uint32_t>() == format_version, "format version");
+    expect(read_value<uint32_t>() == uint32_t(kind), "implementation");
+    expect(read_value<uint32_t>() == sizeof(index_type), "index type");
+    expect(read_value<uint32_t>() == sizeof(value_type), "value type");
+    expect(read_value<uint32_t>() == value_flags<value_type>(), "value type");
+    read_value<uint32_t>();
+    expect(read_value<uint64_t>() == n, "input size");
+    expect(read_value<uint64_t>() == param, "parameters");
+  }
+
+  /**
+   * Reads a table of size elements, as a view of the reader's memory.
+   */
+  template<typename T>
+  table<T> read_table(size_t size) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable tables can be loaded");
+    expect(read_value<uint64_t>() == size, "table size");
+    skip_padding();
+    const char *p = read_bytes(size * sizeof(T));
+    expect(reinterpret_cast<uintptr_t>(p) % alignof(T) == 0, "alignment");
+    return table<T>(reinterpret_cast<const T *>(p), size, _file);
+  }
+};
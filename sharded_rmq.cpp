@@ -0,0 +1,65 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "opt_rmq.hpp"
+#include "rmq_test.hpp"
+#include "sharded_rmq.hpp"
+#include "sparse_rmq.hpp"
+
+// Shards much smaller than the test inputs, which don't divide their
+// lengths either.
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
+  >
+using sparse_sharded_rmq =
+  sharded_rmq<iterator_type,
+              sparse_rmq<iterator_type, value_type, difference_type, index_type>,
+              value_type, difference_type, index_type, 1000>;
+
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
+  >
+using opt_sharded_rmq =
+  sharded_rmq<iterator_type,
+              opt_rmq<iterator_type, value_type, difference_type, index_type>,
+              value_type, difference_type, index_type, 3>;
+
+/**
+ * Checks that rebuilding a shard after changing its values gives the
+ * right answers for the new values.
+ */
+void rebuild_test() {
+  typedef std::vector<int>::const_iterator iterator_type;
+  std::vector<int> input(10000);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = 1000 + std::rand() % 1000;
+  }
+  sparse_sharded_rmq<iterator_type> im(input.begin(), input.end());
+  for (size_t k : {size_t(0), size_t(4), size_t(9)}) {
+    input[k * 1000 + 17] = int(k);
+    im.rebuild_shard(k);
+    for (size_t i = 0; i < 10000; ++i) {
+      const size_t u = size_t(std::rand()) % input.size();
+      const size_t v = u + 1 + size_t(std::rand()) % (input.size() - u);
+      assert(input[im.query_offset(u, v)] == *std::min_element(input.begin() + u, input.begin() + v));
+    }
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(sparse_sharded_rmq, 1000000);
+  RMQ_NARROW_TEST_BODY(sparse_sharded_rmq, 1000000);
+  rmq_test::threaded_test<sparse_sharded_rmq<std::vector<int>::const_iterator>>();
+  RMQ_TEST_BODY(opt_sharded_rmq, 100000);
+  rebuild_test();
+  return 0;
+}
@@ -0,0 +1,234 @@
+/**
+ * Implements RMQ over an input split into fixed-size shards, each with
+ * an RMQ implementation of its own, plus a sparse_rmq over the shards'
+ * minima.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "parallel.hpp"
+#include "rmq.hpp"
+#include "table.hpp"
+
+#include "sparse_rmq.hpp"
+
+/**
+ * This is pm_rmq's super array idea one level up: the input is cut into
+ * shards of shard_size elements (the last may be shorter), each shard is
+ * indexed by its own shard_rmq_type, and a sparse_rmq over the shards'
+ * minima answers for the whole shards a query spans.  A query within one
+ * shard goes straight to that shard's implementation, one crossing
+ * shards combines the answers at either end with the whole shards in
+ * between.
+ *
+ * shard_rmq_type can be any RMQ implementation over iterator_type that
+ * can be constructed from (b, e), and is built on each shard
+ * independently, so that:
+ *
+ *  - shards are built in parallel, one per thread at a time,
+ *  - no allocation is larger than one shard's tables, however large the
+ *    input, and
+ *  - after a shard's values change, rebuild_shard rebuilds just that
+ *    shard, and the small table over the shards' minima.
+ *
+ * shard_size comes after the usual template parameters so that it can
+ * have a default, which is large enough that the shards' minima and
+ * their sparse_rmq are a small part of the whole.
+ *
+ * Answers within a shard are shard_rmq_type's, and across shards ties
+ * go to the leftmost shard.
+ */
+template<
+  typename iterator_type,
+  typename shard_rmq_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type,
+  size_t shard_size=size_t(1) << 20
+  >
+class sharded_rmq : public rmq<sharded_rmq<iterator_type, shard_rmq_type, value_type,
+                                           difference_type, index_type, shard_size>,
+                                iterator_type, value_type, difference_type> {
+
+  static_assert(shard_size > 0, "shards can't be empty");
+
+  typedef rmq<sharded_rmq, iterator_type, value_type, difference_type> rmq_base;
+
+  // Compilers are dumb.
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+  using rmq_base::prefetch;
+
+  static const difference_type ss = shard_size;
+
+  std::vector<std::unique_ptr<shard_rmq_type> > _shards;
+
+  /**
+   * The minimum value in each shard, and its position (as an offset from
+   * the beginning of the input), which index_type has to be able to
+   * hold.
+   */
+  table<value_type> _shard_min_vals;
+  table<index_type> _shard_min_idxs;
+
+  typedef typename table<value_type>::const_iterator shard_iterator_type;
+  typedef sparse_rmq<shard_iterator_type, value_type,
+                     typename std::iterator_traits<shard_iterator_type>::difference_type,
+                     index_type> shard_min_rmq_type;
+  std::unique_ptr<shard_min_rmq_type> _shard_min_rmq;
+
+  difference_type num_shards() const {
+    return (n() + ss - 1) / ss;
+  }
+
+  void build_shard(difference_type k) {
+    const iterator_type shard_begin = begin() + k * ss;
+    const difference_type len = std::min(difference_type(ss), n() - k * ss);
+    _shards[k].reset(new shard_rmq_type(shard_begin, shard_begin + len));
+    const difference_type min_idx = k * ss + _shards[k]->query_offset(0, len);
+    _shard_min_vals[k] = val(min_idx);
+    _shard_min_idxs[k] = min_idx;
+  }
+
+  void build_shard_min_rmq() {
+    _shard_min_rmq.reset(new shard_min_rmq_type(_shard_min_vals.cbegin(), _shard_min_vals.cend()));
+  }
+
+  /**
+   * Queries [uo, vo), which should lie within shard k, on that shard.
+   */
+  difference_type query_shard(difference_type k, difference_type uo, difference_type vo) const {
+    return k * ss + _shards[k]->query_offset(uo - k * ss, vo - k * ss);
+  }
+
+  /**
+   * Combines the answers for the partial shards at either end of a query
+   * with the shards strictly between them, preferring the leftmost.
+   */
+  difference_type combine(difference_type u_min_idx, difference_type v_min_idx,
+                          difference_type u_shard_idx, difference_type v_shard_idx,
+                          difference_type shard_min_idx) const {
+    difference_type min_idx = u_min_idx;
+    if (v_shard_idx - u_shard_idx > 1 && _shard_min_vals[shard_min_idx] < val(min_idx)) {
+      min_idx = _shard_min_idxs[shard_min_idx];
+    }
+    return val(v_min_idx) < val(min_idx) ? v_min_idx : min_idx;
+  }
+
+public:
+  /**
+   * Preprocess the array [b,e) for RMQ queries, building up to threads
+   * shards at a time.
+   */
+  sharded_rmq(iterator_type b, iterator_type e, unsigned threads = 1)
+    : rmq_base(b, e),
+      _shards(num_shards()),
+      _shard_min_vals(num_shards()),
+      _shard_min_idxs(num_shards())
+  {
+    parallel_for(0, num_shards(), threads,
+                 [this](size_t lo, size_t hi) {
+                   for (size_t k = lo; k < hi; ++k) {
+                     build_shard(difference_type(k));
+                   }
+                 }, 1);
+    build_shard_min_rmq();
+  }
+
+  /**
+   * Rebuilds shard k, which holds offsets [k * shard_size, (k + 1) *
+   * shard_size), after its values have changed.  Queries can't run
+   * while it does.
+   */
+  void rebuild_shard(difference_type k) {
+    assert(0 <= k && k < num_shards());
+    build_shard(k);
+    build_shard_min_rmq();
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    size_t shard_bytes = 0;
+    for (const std::unique_ptr<shard_rmq_type> &shard : _shards) {
+      shard_bytes += shard->bytes_used();
+    }
+    usage.add("shards", shard_bytes);
+    usage.add("shard_minima", _shard_min_vals.bytes_used() + _shard_min_idxs.bytes_used());
+    usage.add("shard_min_rmq", _shard_min_rmq->memory_usage());
+    return usage;
+  }
+
+  difference_type query(iterator_type u, iterator_type v) const {
+    const difference_type uo = u - begin();
+    const difference_type vo = v - begin();
+    const difference_type u_shard_idx = uo / ss;
+    const difference_type v_shard_idx = (vo - 1) / ss;
+    if (u_shard_idx == v_shard_idx) {
+      return query_shard(u_shard_idx, uo, vo);
+    }
+
+    // Don't query the shards' minima when u's and v's shards are
+    // adjacent, sparse_rmq doesn't handle zero-length intervals.
+    const difference_type u_min_idx = query_shard(u_shard_idx, uo, (u_shard_idx + 1) * ss);
+    const difference_type v_min_idx = query_shard(v_shard_idx, v_shard_idx * ss, vo);
+    const difference_type shard_min_idx = v_shard_idx - u_shard_idx > 1
+      ? _shard_min_rmq->query_offset(u_shard_idx + 1, v_shard_idx)
+      : 0;
+    return combine(u_min_idx, v_min_idx, u_shard_idx, v_shard_idx, shard_min_idx);
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    // Gather the queries that span whole shards into a chunk for
+    // _shard_min_rmq, whose misses overlap, then query the shards at
+    // either end and combine.  The shards' own queries are run one at a
+    // time, since they're on different implementations.
+    difference_type u_shard_idxs[rmq_base::chunk_size];
+    difference_type v_shard_idxs[rmq_base::chunk_size];
+    difference_type shard_uos[rmq_base::chunk_size];
+    difference_type shard_vos[rmq_base::chunk_size];
+    size_t shard_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      u_shard_idxs[i] = uos[i] / ss;
+      v_shard_idxs[i] = (vos[i] - 1) / ss;
+      if (v_shard_idxs[i] - u_shard_idxs[i] > 1) {
+        shard_uos[shard_count] = u_shard_idxs[i] + 1;
+        shard_vos[shard_count] = v_shard_idxs[i];
+        ++shard_count;
+      }
+    }
+
+    difference_type shard_min_idxs[rmq_base::chunk_size];
+    if (shard_count > 0) {
+      _shard_min_rmq->query_chunk(shard_uos, shard_vos, shard_count, shard_min_idxs);
+    }
+    for (size_t i = 0; i < shard_count; ++i) {
+      prefetch(&_shard_min_vals[shard_min_idxs[i]]);
+    }
+
+    size_t shard_i = 0;
+    for (size_t i = 0; i < count; ++i) {
+      const difference_type u_shard_idx = u_shard_idxs[i];
+      const difference_type v_shard_idx = v_shard_idxs[i];
+      if (u_shard_idx == v_shard_idx) {
+        out[i] = query_shard(u_shard_idx, uos[i], vos[i]);
+      } else {
+        const difference_type u_min_idx = query_shard(u_shard_idx, uos[i], (u_shard_idx + 1) * ss);
+        const difference_type v_min_idx = query_shard(v_shard_idx, v_shard_idx * ss, vos[i]);
+        const difference_type shard_min_idx = v_shard_idx - u_shard_idx > 1
+          ? shard_min_idxs[shard_i++]
+          : 0;
+        out[i] = combine(u_min_idx, v_min_idx, u_shard_idx, v_shard_idx, shard_min_idx);
+      }
+    }
+  }
+};
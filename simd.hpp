@@ -0,0 +1,445 @@
+/**
+ * Vectorized kernels for building tables over, and scanning, arrays of
+ * arithmetic values.
+ *
+ * Each kernel has a plain loop that works for any type with operator<,
+ * plus hand-written AVX2 versions for the common 32 and 64-bit types
+ * when compiling with -mavx2 or -march=native.  The vector versions give
+ * exactly the same answers as the plain loops, ties included.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace simd {
+
+/**
+ * Whether iterator_type points into contiguous storage of an arithmetic
+ * type, so &*it can be handed to the kernels below.  We can't detect
+ * contiguity in general before C++20, so this only recognizes pointers
+ * and std::vector's iterators.
+ */
+template<typename iterator_type>
+struct packable {
+  typedef typename std::iterator_traits<iterator_type>::value_type value_type;
+  static const bool value =
+    std::is_arithmetic<value_type>::value &&
+    !std::is_same<value_type, bool>::value &&
+    (std::is_pointer<iterator_type>::value ||
+     std::is_same<iterator_type, typename std::vector<value_type>::iterator>::value ||
+     std::is_same<iterator_type, typename std::vector<value_type>::const_iterator>::value);
+};
+
+/**
+ * For each k < count, writes the lesser of (xv[k], xi[k]) and (yv[k],
+ * yi[k]) to (out_v[k], out_i[k]), comparing values and preferring y on
+ * ties, like the sparse and naive tables' dynamic programs do through
+ * index indirection.  The outputs must not overlap the inputs.
+ */
+template<typename value_type, typename index_type>
+void min_level_scalar(const value_type *xv, const value_type *yv,
+                      const index_type *xi, const index_type *yi, size_t count,
+                      value_type *__restrict out_v, index_type *__restrict out_i) {
+  for (size_t k = 0; k < count; ++k) {
+    const bool less = xv[k] < yv[k];
+    out_v[k] = less ? xv[k] : yv[k];
+    out_i[k] = less ? xi[k] : yi[k];
+  }
+}
+
+/**
+ * Handles as much of a min_level call as it can with vector
+ * instructions, and returns how many elements it did.  The generic
+ * version does none.  Callers check vectorized to decide whether it's
+ * worth arranging their data for min_level at all.
+ */
+template<typename value_type, typename index_type, typename enable = void>
+struct vector_min_level {
+  static const bool vectorized = false;
+
+  static size_t run(const value_type *, const value_type *,
+                    const index_type *, const index_type *, size_t,
+                    value_type *, index_type *) {
+    return 0;
+  }
+};
+
+/**
+ * Sets bit i of the result if p[i] < p[i + 1], for i < steps.
+ *
+ * Preconditions:
+ *  steps <= 64
+ */
+template<typename value_type>
+uint64_t step_mask_scalar(const value_type *p, size_t steps) {
+  uint64_t s = 0;
+  for (size_t i = 0; i < steps; ++i) {
+    s |= uint64_t(p[i] < p[i + 1]) << i;
+  }
+  return s;
+}
+
+/**
+ * Like vector_min_level, for step_mask.  Returns how many steps it did,
+ * writing their bits to s.
+ */
+template<typename value_type>
+struct vector_step_mask {
+  static size_t run(const value_type *, size_t, uint64_t &) {
+    return 0;
+  }
+};
+
+/**
+ * Returns the offset of the leftmost minimum of p[0, len).
+ *
+ * Preconditions:
+ *  len > 0
+ */
+template<typename value_type>
+size_t argmin_scalar(const value_type *p, size_t len) {
+  size_t best = 0;
+  for (size_t i = 1; i < len; ++i) {
+    if (p[i] < p[best]) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+/**
+ * Like vector_min_level, for argmin.  Scans are short, so the vector
+ * versions do the whole scan themselves.
+ */
+template<typename value_type>
+struct vector_argmin {
+  static size_t run(const value_type *p, size_t len) {
+    return argmin_scalar(p, len);
+  }
+};
+
+/**
+ * Returns the offset of the leftmost minimum of block[lo, hi), where
+ * block holds block_size values.  Knowing the block's size lets the
+ * vector versions load the whole block, unrolled, and mask off the
+ * elements outside the range instead of looping over just the range, so
+ * they run without any data-dependent branches.
+ *
+ * Preconditions:
+ *  lo < hi <= block_size
+ */
+template<typename value_type, size_t block_size, typename enable = void>
+struct vector_block_argmin {
+  static size_t run(const value_type *block, size_t lo, size_t hi) {
+    return lo + vector_argmin<value_type>::run(block + lo, hi - lo);
+  }
+};
+
+#ifdef __AVX2__
+
+/**
+ * Compares eight 32-bit values of x and y, storing the lesser of each
+ * pair (y on ties) to out, and returns a mask with the lanes where x was
+ * less set.
+ */
+inline __m256i less8(const int32_t *x, const int32_t *y, int32_t *out) {
+  const __m256i xv = _mm256_loadu_si256((const __m256i *) x);
+  const __m256i yv = _mm256_loadu_si256((const __m256i *) y);
+  const __m256i less = _mm256_cmpgt_epi32(yv, xv);
+  _mm256_storeu_si256((__m256i *) out, _mm256_blendv_epi8(yv, xv, less));
+  return less;
+}
+
+inline __m256i less8(const float *x, const float *y, float *out) {
+  // Ordered, so a NaN on either side takes y, like x < y does.
+  const __m256 xv = _mm256_loadu_ps(x);
+  const __m256 yv = _mm256_loadu_ps(y);
+  const __m256 less = _mm256_cmp_ps(xv, yv, _CMP_LT_OQ);
+  _mm256_storeu_ps(out, _mm256_blendv_ps(yv, xv, less));
+  return _mm256_castps_si256(less);
+}
+
+/**
+ * Picks eight indexes from x where less is set and from y elsewhere.
+ */
+template<typename index_type>
+void blend8(__m256i less, const index_type *x, const index_type *y, index_type *out,
+            std::integral_constant<size_t, 4>) {
+  const __m256i xv = _mm256_loadu_si256((const __m256i *) x);
+  const __m256i yv = _mm256_loadu_si256((const __m256i *) y);
+  _mm256_storeu_si256((__m256i *) out, _mm256_blendv_epi8(yv, xv, less));
+}
+
+template<typename index_type>
+void blend8(__m256i less, const index_type *x, const index_type *y, index_type *out,
+            std::integral_constant<size_t, 8>) {
+  // Widen each half of the 32-bit lane mask to 64-bit lanes.
+  const __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(less));
+  const __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(less, 1));
+  const __m256i *xs = (const __m256i *) x;
+  const __m256i *ys = (const __m256i *) y;
+  __m256i *outs = (__m256i *) out;
+  _mm256_storeu_si256(outs, _mm256_blendv_epi8(_mm256_loadu_si256(ys), _mm256_loadu_si256(xs), lo));
+  _mm256_storeu_si256(outs + 1, _mm256_blendv_epi8(_mm256_loadu_si256(ys + 1), _mm256_loadu_si256(xs + 1), hi));
+}
+
+template<typename value_type, typename index_type>
+struct vector_min_level<
+  value_type, index_type,
+  typename std::enable_if<(std::is_same<value_type, int32_t>::value ||
+                           std::is_same<value_type, float>::value) &&
+                          std::is_integral<index_type>::value &&
+                          (sizeof(index_type) == 4 || sizeof(index_type) == 8)>::type> {
+  static const bool vectorized = true;
+
+  static size_t run(const value_type *xv, const value_type *yv,
+                    const index_type *xi, const index_type *yi, size_t count,
+                    value_type *out_v, index_type *out_i) {
+    size_t k = 0;
+    for (; k + 8 <= count; k += 8) {
+      const __m256i less = less8(xv + k, yv + k, out_v + k);
+      blend8(less, xi + k, yi + k, out_i + k,
+             std::integral_constant<size_t, sizeof(index_type)>());
+    }
+    return k;
+  }
+};
+
+template<typename index_type>
+struct vector_min_level<
+  int64_t, index_type,
+  typename std::enable_if<std::is_integral<index_type>::value &&
+                          sizeof(index_type) == 8>::type> {
+  static const bool vectorized = true;
+
+  static size_t run(const int64_t *xv, const int64_t *yv,
+                    const index_type *xi, const index_type *yi, size_t count,
+                    int64_t *out_v, index_type *out_i) {
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+      const __m256i x = _mm256_loadu_si256((const __m256i *) (xv + k));
+      const __m256i y = _mm256_loadu_si256((const __m256i *) (yv + k));
+      const __m256i less = _mm256_cmpgt_epi64(y, x);
+      _mm256_storeu_si256((__m256i *) (out_v + k), _mm256_blendv_epi8(y, x, less));
+      const __m256i x_idx = _mm256_loadu_si256((const __m256i *) (xi + k));
+      const __m256i y_idx = _mm256_loadu_si256((const __m256i *) (yi + k));
+      _mm256_storeu_si256((__m256i *) (out_i + k), _mm256_blendv_epi8(y_idx, x_idx, less));
+    }
+    return k;
+  }
+};
+
+template<>
+struct vector_step_mask<int32_t> {
+  static size_t run(const int32_t *p, size_t steps, uint64_t &s) {
+    size_t i = 0;
+    for (; i + 8 <= steps; i += 8) {
+      const __m256i a = _mm256_loadu_si256((const __m256i *) (p + i));
+      const __m256i b = _mm256_loadu_si256((const __m256i *) (p + i + 1));
+      const int bits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a)));
+      s |= uint64_t(unsigned(bits)) << i;
+    }
+    return i;
+  }
+};
+
+template<>
+struct vector_step_mask<int64_t> {
+  static size_t run(const int64_t *p, size_t steps, uint64_t &s) {
+    size_t i = 0;
+    for (; i + 4 <= steps; i += 4) {
+      const __m256i a = _mm256_loadu_si256((const __m256i *) (p + i));
+      const __m256i b = _mm256_loadu_si256((const __m256i *) (p + i + 1));
+      const int bits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a)));
+      s |= uint64_t(unsigned(bits)) << i;
+    }
+    return i;
+  }
+};
+
+/**
+ * These find the minimum value first and then the first lane equal to
+ * it.  Both passes finish with a load of the last full vector, which may
+ * overlap elements we've already looked at, but that changes neither
+ * the minimum nor which equal element comes first.
+ */
+template<>
+struct vector_argmin<int32_t> {
+  static size_t run(const int32_t *p, size_t len) {
+    if (len < 8) {
+      return argmin_scalar(p, len);
+    }
+    const __m256i *last = (const __m256i *) (p + len - 8);
+    __m256i m = _mm256_loadu_si256((const __m256i *) p);
+    size_t i = 8;
+    for (; i + 8 <= len; i += 8) {
+      m = _mm256_min_epi32(m, _mm256_loadu_si256((const __m256i *) (p + i)));
+    }
+    m = _mm256_min_epi32(m, _mm256_loadu_si256(last));
+    __m128i h = _mm_min_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+    const __m256i target = _mm256_broadcastd_epi32(h);
+
+    for (i = 0; i + 8 <= len; i += 8) {
+      const __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *) (p + i)), target);
+      const int bits = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+      if (bits) {
+        return i + __builtin_ctz(bits);
+      }
+    }
+    const __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256(last), target);
+    return len - 8 + __builtin_ctz(_mm256_movemask_ps(_mm256_castsi256_ps(eq)));
+  }
+};
+
+template<>
+struct vector_argmin<int64_t> {
+  static size_t run(const int64_t *p, size_t len) {
+    if (len < 4) {
+      return argmin_scalar(p, len);
+    }
+    const __m256i *last = (const __m256i *) (p + len - 4);
+    __m256i m = _mm256_loadu_si256((const __m256i *) p);
+    size_t i = 4;
+    for (; i + 4 <= len; i += 4) {
+      const __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+      m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+    }
+    const __m256i x = _mm256_loadu_si256(last);
+    m = _mm256_blendv_epi8(m, x, _mm256_cmpgt_epi64(m, x));
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, m);
+    const __m256i target = _mm256_set1_epi64x(lanes[argmin_scalar(lanes, 4)]);
+
+    for (i = 0; i + 4 <= len; i += 4) {
+      const __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *) (p + i)), target);
+      const int bits = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+      if (bits) {
+        return i + __builtin_ctz(bits);
+      }
+    }
+    const __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256(last), target);
+    return len - 4 + __builtin_ctz(_mm256_movemask_pd(_mm256_castsi256_pd(eq)));
+  }
+};
+
+template<size_t block_size>
+struct vector_block_argmin<int32_t, block_size,
+                           typename std::enable_if<block_size % 8 == 0 &&
+                                                   block_size <= 64>::type> {
+  static size_t run(const int32_t *block, size_t lo, size_t hi) {
+    const size_t vectors = block_size / 8;
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i below = _mm256_set1_epi32(int32_t(lo) - 1);
+    const __m256i above = _mm256_set1_epi32(int32_t(hi));
+    const __m256i top = _mm256_set1_epi32(std::numeric_limits<int32_t>::max());
+    __m256i in[vectors];
+    __m256i x[vectors];
+    __m256i m = top;
+    for (size_t k = 0; k < vectors; ++k) {
+      const __m256i idx = _mm256_add_epi32(lanes, _mm256_set1_epi32(int32_t(8 * k)));
+      in[k] = _mm256_and_si256(_mm256_cmpgt_epi32(idx, below), _mm256_cmpgt_epi32(above, idx));
+      x[k] = _mm256_blendv_epi8(top, _mm256_loadu_si256((const __m256i *) (block + 8 * k)), in[k]);
+      m = _mm256_min_epi32(m, x[k]);
+    }
+    __m128i h = _mm_min_epi32(_mm256_castsi256_si128(m), _mm256_extracti128_si256(m, 1));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1, 0, 3, 2)));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2, 3, 0, 1)));
+    const __m256i target = _mm256_broadcastd_epi32(h);
+
+    uint64_t bits = 0;
+    for (size_t k = 0; k < vectors; ++k) {
+      const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi32(x[k], target), in[k]);
+      bits |= uint64_t(unsigned(_mm256_movemask_ps(_mm256_castsi256_ps(eq)))) << (8 * k);
+    }
+    return __builtin_ctzll(bits);
+  }
+};
+
+template<size_t block_size>
+struct vector_block_argmin<int64_t, block_size,
+                           typename std::enable_if<block_size % 4 == 0 &&
+                                                   block_size <= 64>::type> {
+  static size_t run(const int64_t *block, size_t lo, size_t hi) {
+    const size_t vectors = block_size / 4;
+    const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+    const __m256i below = _mm256_set1_epi64x(int64_t(lo) - 1);
+    const __m256i above = _mm256_set1_epi64x(int64_t(hi));
+    const __m256i top = _mm256_set1_epi64x(std::numeric_limits<int64_t>::max());
+    __m256i in[vectors];
+    __m256i x[vectors];
+    __m256i m = top;
+    for (size_t k = 0; k < vectors; ++k) {
+      const __m256i idx = _mm256_add_epi64(lanes, _mm256_set1_epi64x(int64_t(4 * k)));
+      in[k] = _mm256_and_si256(_mm256_cmpgt_epi64(idx, below), _mm256_cmpgt_epi64(above, idx));
+      x[k] = _mm256_blendv_epi8(top, _mm256_loadu_si256((const __m256i *) (block + 4 * k)), in[k]);
+      m = _mm256_blendv_epi8(m, x[k], _mm256_cmpgt_epi64(m, x[k]));
+    }
+    int64_t lanes_min[4];
+    _mm256_storeu_si256((__m256i *) lanes_min, m);
+    const __m256i target = _mm256_set1_epi64x(lanes_min[argmin_scalar(lanes_min, 4)]);
+
+    uint64_t bits = 0;
+    for (size_t k = 0; k < vectors; ++k) {
+      const __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi64(x[k], target), in[k]);
+      bits |= uint64_t(unsigned(_mm256_movemask_pd(_mm256_castsi256_pd(eq)))) << (4 * k);
+    }
+    return __builtin_ctzll(bits);
+  }
+};
+
+#endif
+
+/**
+ * argmin_scalar, vectorized where we know how.  Floating point types
+ * always use the plain loop, since a packed min doesn't order NaNs the
+ * way it does.
+ */
+template<typename value_type>
+size_t argmin(const value_type *p, size_t len) {
+  return vector_argmin<value_type>::run(p, len);
+}
+
+/**
+ * The leftmost minimum of block[lo, hi) for a block of block_size
+ * values, vectorized where we know how.
+ */
+template<size_t block_size, typename value_type>
+size_t block_argmin(const value_type *block, size_t lo, size_t hi) {
+  return vector_block_argmin<value_type, block_size>::run(block, lo, hi);
+}
+
+/**
+ * min_level_scalar, vectorized where we know how.
+ */
+template<typename value_type, typename index_type>
+void min_level(const value_type *xv, const value_type *yv,
+               const index_type *xi, const index_type *yi, size_t count,
+               value_type *out_v, index_type *out_i) {
+  const size_t k = vector_min_level<value_type, index_type>::run(xv, yv, xi, yi, count,
+                                                                 out_v, out_i);
+  min_level_scalar(xv + k, yv + k, xi + k, yi + k, count - k, out_v + k, out_i + k);
+}
+
+/**
+ * step_mask_scalar, vectorized where we know how.
+ */
+template<typename value_type>
+uint64_t step_mask(const value_type *p, size_t steps) {
+  uint64_t s = 0;
+  const size_t i = vector_step_mask<value_type>::run(p, steps, s);
+  return i < steps ? s | (step_mask_scalar(p + i, steps - i) << i) : s;
+}
+
+}
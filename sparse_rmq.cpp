@@ -1,4 +1,118 @@
 #include "sparse_rmq.hpp"
 #include "rmq_test.hpp"
 
-TEST_IMPL(sparse_rmq)
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type
+  >
+using value_sparse_rmq = sparse_rmq<iterator_type, value_type, difference_type, index_type, true>;
+
+/**
+ * Checks that keeping the values in the table gives exactly the same
+ * answers, ties included, as looking them up.
+ */
+void inline_values_test(size_t N) {
+  typedef std::vector<int>::const_iterator iterator_type;
+  typedef std::vector<int>::difference_type difference_type;
+  std::vector<int> input(N);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 100;
+  }
+  const sparse_rmq<iterator_type, int, difference_type, uint32_t> plain(input.begin(), input.end());
+  const value_sparse_rmq<iterator_type, int, difference_type, uint32_t> inlined(input.begin(), input.end());
+  std::vector<std::pair<difference_type, difference_type> > queries;
+  for (size_t i = 0; i < 100000; ++i) {
+    const difference_type u = std::rand() % difference_type(N);
+    const difference_type v = u + 1 + std::rand() % (difference_type(N) - u);
+    queries.push_back(std::make_pair(u, v));
+  }
+  std::vector<difference_type> expected;
+  std::vector<difference_type> answers;
+  plain.query_batch(queries.begin(), queries.end(), std::back_inserter(expected));
+  inlined.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+  assert(answers == expected);
+  for (size_t i = 0; i < 1000; ++i) {
+    assert(inlined.query_offset(queries[i].first, queries[i].second) == expected[i]);
+  }
+}
+
+/**
+ * Checks that impl, capped for queries of up to max_length elements,
+ * answers longer queries too, up to max_factor times as long, with a
+ * minimum of each (which the uncapped one's may tie with).
+ */
+template<typename impl>
+void over_cap_test(const std::vector<int> &input, std::ptrdiff_t max_length,
+                   std::ptrdiff_t max_factor) {
+  typedef std::vector<int>::difference_type difference_type;
+  const difference_type N = difference_type(input.size());
+  const impl capped(input.begin(), input.end(), 1, nullptr, max_length);
+  std::vector<std::pair<difference_type, difference_type> > queries;
+  for (size_t i = 0; i < 2000; ++i) {
+    const difference_type len =
+      std::min(N, max_length + 1 + std::rand() % (max_length * max_factor));
+    const difference_type u = std::rand() % (N - len + 1);
+    queries.push_back(std::make_pair(u, u + len));
+  }
+  queries.push_back(std::make_pair(difference_type(0), N));
+  std::vector<difference_type> answers;
+  capped.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+  for (size_t i = 0; i < queries.size(); ++i) {
+    const difference_type u = queries[i].first;
+    const difference_type v = queries[i].second;
+    assert(u <= answers[i] && answers[i] < v);
+    assert(input[answers[i]] == *std::min_element(input.begin() + u, input.begin() + v));
+    assert(capped.query_offset(u, v) == answers[i]);
+  }
+}
+
+/**
+ * Checks that a sparse_rmq with its levels capped for queries of up to
+ * max_length gives the same answers as an uncapped one on such queries,
+ * and is smaller, and answers longer ones too.
+ */
+void capped_test(size_t N, std::ptrdiff_t max_length) {
+  typedef std::vector<int>::const_iterator iterator_type;
+  typedef std::vector<int>::difference_type difference_type;
+  std::vector<int> input(N);
+  for (std::vector<int>::iterator it = input.begin(); it != input.end(); ++it) {
+    *it = std::rand() % 1000;
+  }
+  const sparse_rmq<iterator_type> full(input.begin(), input.end());
+  const sparse_rmq<iterator_type> capped(input.begin(), input.end(), 2, nullptr, max_length);
+  assert(capped.bytes_used() < full.bytes_used());
+
+  std::vector<std::pair<difference_type, difference_type> > queries;
+  for (size_t i = 0; i < 100000; ++i) {
+    const difference_type len = 1 + std::rand() % max_length;
+    const difference_type u = std::rand() % (difference_type(N) - len + 1);
+    queries.push_back(std::make_pair(u, u + len));
+  }
+  std::vector<difference_type> expected;
+  std::vector<difference_type> answers;
+  full.query_batch(queries.begin(), queries.end(), std::back_inserter(expected));
+  capped.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+  assert(answers == expected);
+  for (size_t i = 0; i < 1000; ++i) {
+    assert(capped.query_offset(queries[i].first, queries[i].second) == expected[i]);
+  }
+
+  over_cap_test<sparse_rmq<iterator_type> >(input, max_length, 20);
+  over_cap_test<value_sparse_rmq<iterator_type> >(input, max_length, 20);
+}
+
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(sparse_rmq, 1000000);
+  RMQ_NARROW_TEST_BODY(sparse_rmq, 1000000);
+  rmq_test::threaded_test<sparse_rmq<std::vector<int>::const_iterator>>();
+  capped_test(1000000, 100);
+  capped_test(1000000, 1024);
+  capped_test(1000, 2);
+  RMQ_TEST_BODY(value_sparse_rmq, 1000000);
+  RMQ_NARROW_TEST_BODY(value_sparse_rmq, 1000000);
+  rmq_test::threaded_test<value_sparse_rmq<std::vector<int>::const_iterator>>();
+  inline_values_test(1000000);
+  return 0;
+}
@@ -2,90 +2,387 @@
  * Implements the sparse <O(n log n), O(1)> RMQ solution.
  */
 
+#pragma once
+
 #include <algorithm>
-#include <cmath>
+#include <cassert>
+#include <cstdint>
 #include <iterator>
+#include <type_traits>
 #include <vector>
 
 #include <boost/iterator/counting_iterator.hpp>
 
+#include "instrument.hpp"
+#include "parallel.hpp"
 #include "rmq.hpp"
+#include "serialize.hpp"
+#include "simd.hpp"
+#include "table.hpp"
 
+/**
+ * With inline_values, each entry of the table holds the minimum value of
+ * its interval next to its index, so that a query compares the two
+ * entries it loads instead of following them into the input, halving
+ * the cache misses of queries on large inputs.  The price is a table
+ * that's larger by a value per entry, twice as large for ints with
+ * 32-bit indexes, and a build that doesn't use the vector kernels.
+ * inline_values comes after the usual template parameters so that it
+ * can default to off.
+ */
 template<
   typename iterator_type,
   typename value_type=typename std::iterator_traits<iterator_type>::value_type,
-  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type,
+  typename index_type=difference_type,
+  bool inline_values=false
   >
-class sparse_rmq : public rmq<iterator_type, value_type, difference_type> {
+class sparse_rmq : public rmq<sparse_rmq<iterator_type, value_type, difference_type, index_type,
+                                         inline_values>,
+                               iterator_type, value_type, difference_type> {
+
+  typedef rmq<sparse_rmq, iterator_type, value_type, difference_type> rmq_base;
 
   // Compilers are dumb.
-  using rmq<iterator_type, value_type, difference_type>::begin;
-  using rmq<iterator_type, value_type, difference_type>::end;
-  using rmq<iterator_type, value_type, difference_type>::n;
-  using rmq<iterator_type, value_type, difference_type>::val;
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+
+  using rmq_base::lg;
+  using rmq_base::prefetch;
 
-  typedef typename std::vector<std::vector<difference_type>>::difference_type level_type;
+  typedef typename std::vector<index_type>::size_type size_type;
+  typedef difference_type level_type;
 
   /**
    * The log_2 of the problem size, lg(n) (this is the depth we need to
-   * precompute answers down to).
+   * precompute answers down to), or of the longest query asked for, if
+   * that's shorter.
    */
   const level_type _logn;
 
   /**
-   * 2D array of precomputed answers.
+   * Where each level starts in _arr.  Level d holds the answers for the
+   * n - 2^d + 1 intervals of length 2^d, and _level_offsets[_logn + 1]
+   * is the total size of _arr.
+   */
+  table<size_type> _level_offsets;
+
+  /**
+   * A table entry with inline_values.
+   */
+  struct value_cell {
+    value_type value;
+    index_type index;
+  };
+
+  typedef typename std::conditional<inline_values, value_cell, index_type>::type cell_type;
+
+  /**
+   * All the precomputed answers, in one table with the levels laid out
+   * back to back.
    *
-   * _arr[a][b] is the minimum value in the range [a, a+b].
+   * _arr[_level_offsets[d] + a] is the index of the minimum value in the
+   * range [a, a + 2^d), and with inline_values that value too.  Indexes
+   * are stored as index_type, which can be narrower than difference_type
+   * to save space as long as it can hold n().
+   */
+  table<cell_type> _arr;
+
+  /**
+   * The index in an entry, and the value at it.
+   */
+  static difference_type index_of(const index_type &c) { return c; }
+
+  static difference_type index_of(const value_cell &c) { return c.index; }
+
+  const value_type &value_of(const index_type &c) const { return val(c); }
+
+  static const value_type &value_of(const value_cell &c) { return c.value; }
+
+  /**
+   * Sets an entry.  Cells are written a field at a time, never copied
+   * whole, so that their padding stays the zeroes the table started with
+   * and save() writes the same bytes for the same input.
+   */
+  static void set_cell(index_type &c, index_type i, const value_type &) {
+    c = i;
+  }
+
+  static void set_cell(value_cell &c, index_type i, const value_type &v) {
+    c.value = v;
+    c.index = i;
+  }
+
+  static void set_cell(index_type &c, const index_type &from) {
+    c = from;
+  }
+
+  static void set_cell(value_cell &c, const value_cell &from) {
+    set_cell(c, from.index, from.value);
+  }
+
+  /**
+   * For a query [x, y) longer than twice the deepest level's intervals,
+   * which only happens when max_length left out the levels it needs:
+   * the lesser of best, the minimum of the intervals at either end, and
+   * the deepest level's entries for the intervals in between, a level's
+   * width apart.
+   */
+  const cell_type *min_between(const cell_type *level, difference_type x, difference_type y,
+                               const cell_type *best) const {
+    const difference_type width = difference_type(1) << _logn;
+    for (difference_type a = x + width; a < y - width; a += width) {
+      if (value_of(level[a]) < value_of(*best)) {
+        best = level + a;
+      }
+    }
+    return best;
+  }
+
+  /**
+   * The deepest level needed for queries on n elements of up to
+   * max_length (0 for any length) elements.
+   */
+  static level_type max_level(difference_type n, difference_type max_length) {
+    const level_type logn = std::max(difference_type(1), lg(n));
+    return max_length > 0 ? std::min(logn, std::max(difference_type(1), lg(max_length))) : logn;
+  }
+
+  /**
+   * What save() puts in the header's param: the deepest level if it's
+   * been capped, so that loading can check it's expecting the same
+   * levels, or 0 if not.
+   */
+  uint64_t header_param() const {
+    return _logn == max_level(n(), 0) ? 0 : uint64_t(_logn);
+  }
+
+  /**
+   * The two layouts are saved as different kinds of index, so that
+   * neither loads as the other.
+   */
+  static index_kind kind() {
+    return inline_values ? index_kind::sparse_values : index_kind::sparse;
+  }
+
+  /**
+   * Number of intervals of length 2^d that fit in the input.
+   */
+  size_type level_size(level_type d) const {
+    const difference_type width = difference_type(1) << d;
+    return n() >= width ? size_type(n() - width + 1) : 0;
+  }
+
+  /**
+   * Computes _level_offsets from the problem size, in a table taken from
+   * storage if it's given.
    */
-  std::vector<std::vector<difference_type>> _arr;
+  static table<size_type> level_offsets(difference_type n, level_type logn, arena *storage) {
+    table<size_type> offsets(logn + 2, storage);
+    offsets[0] = 0;
+    for (level_type d = 0; d <= logn; ++d) {
+      const difference_type width = difference_type(1) << d;
+      offsets[d + 1] = offsets[d] + (n >= width ? size_type(n - width + 1) : 0);
+    }
+    return offsets;
+  }
 
   /**
-   * Dynamic program to fill in _arr.
+   * Fills in level 0 of _arr, where each interval of length one starting
+   * at i should return the value at i.
    */
-  void fill_in() {
-    // Each interval of zero length starting at i should return the value
-    // at i.
-    std::copy_n(boost::counting_iterator<difference_type>(0), n(),
-                std::back_inserter(_arr[0]));
-    
+  void fill_in_first_level(unsigned threads) {
+    fill_in_first_level(threads, std::integral_constant<bool, inline_values>());
+  }
+
+  void fill_in_first_level(unsigned threads, std::false_type) {
+    const auto first = _arr.begin();
+    parallel_for(0, n(), threads,
+                 [first](size_t lo, size_t hi) {
+                   std::copy_n(boost::counting_iterator<index_type>(lo), hi - lo,
+                               first + lo);
+                 });
+  }
+
+  void fill_in_first_level(unsigned threads, std::true_type) {
+    const auto first = _arr.begin();
+    parallel_for(0, n(), threads,
+                 [this, first](size_t lo, size_t hi) {
+                   for (size_t i = lo; i < hi; ++i) {
+                     set_cell(first[i], index_type(i), val(i));
+                   }
+                 });
+  }
+
+  /**
+   * Dynamic program to fill in _arr.  Each level only depends on the
+   * previous one, so we split each level's range across threads.
+   */
+  void fill_in(unsigned threads, std::false_type) {
+    fill_in_first_level(threads);
+
     // The depth goes up to lg(n).
     for (level_type d = 0; d < _logn; ++d) {
-      // We need to compute all intervals of length 2^d up through the one
-      // that starts 2^d away from the end, hence the upper limit here is
-      // (n - 2^d).
-      const typename std::vector<difference_type>::difference_type width = 1<<d;
-      // Form the next array by zipping pairs of elements in the dth array
-      // that are width apart, taking the index of the lesser one.
-      std::transform(_arr[d].begin(), _arr[d].end() - width,
-                     _arr[d].begin() + width,
-                     std::back_inserter(_arr[d+1]),
-                     [this](const difference_type &x, const difference_type &y) {
-                       return val(x) < val(y) ? x : y;
-                     });
+      // We need to compute all intervals of length 2^(d+1), each of which
+      // is made of two intervals of length 2^d that are width apart.
+      const difference_type width = difference_type(1) << d;
+      const auto prev = _arr.begin() + _level_offsets[d];
+      const auto next = _arr.begin() + _level_offsets[d + 1];
+      // Form the next level by zipping pairs of elements in the dth
+      // level that are width apart, taking the entry of the lesser one.
+      parallel_for(0, level_size(d + 1), threads,
+                   [this, prev, next, width](size_t lo, size_t hi) {
+                     for (size_t i = lo; i < hi; ++i) {
+                       const cell_type &x = prev[i];
+                       const cell_type &y = prev[i + width];
+                       set_cell(next[i], value_of(x) < value_of(y) ? x : y);
+                     }
+                   });
+    }
+  }
+
+  /**
+   * The same dynamic program for the value and index types that
+   * simd::min_level has vector instructions for.  It also carries each
+   * level's minimum values alongside its indexes (in two scratch arrays
+   * of n() values we swap between levels), so that the comparisons read
+   * consecutive values instead of chasing indexes, and can be done many
+   * at a time.
+   */
+  void fill_in(unsigned threads, std::true_type) {
+    fill_in_first_level(threads);
+
+    std::vector<value_type> vals(n());
+    std::vector<value_type> next_vals(n());
+    const iterator_type b = begin();
+    value_type *const first_vals = vals.data();
+    parallel_for(0, n(), threads,
+                 [b, first_vals](size_t lo, size_t hi) {
+                   std::copy(b + lo, b + hi, first_vals + lo);
+                 });
+
+    for (level_type d = 0; d < _logn; ++d) {
+      const size_t width = size_t(1) << d;
+      const index_type *prev = _arr.data() + _level_offsets[d];
+      index_type *next = _arr.data() + _level_offsets[d + 1];
+      const value_type *prev_vals = vals.data();
+      value_type *out_vals = next_vals.data();
+      parallel_for(0, level_size(d + 1), threads,
+                   [prev, next, prev_vals, out_vals, width](size_t lo, size_t hi) {
+                     simd::min_level(prev_vals + lo, prev_vals + lo + width,
+                                     prev + lo, prev + lo + width, hi - lo,
+                                     out_vals + lo, next + lo);
+                   });
+      vals.swap(next_vals);
     }
   }
 
 public:
-  sparse_rmq(iterator_type b, iterator_type e)
-    : rmq<iterator_type, value_type, difference_type>(b, e),
-      _logn(std::max(difference_type(1),
-                     difference_type(std::floor(std::log2(n()))))),
-      _arr(_logn + 1)
+  /**
+   * Preprocess the array [b,e) for RMQ queries, using up to threads
+   * threads, and taking the table from storage if it's given.
+   *
+   * If max_length isn't 0, only the levels needed for queries of up to
+   * max_length elements are built, which for short queries on a large
+   * input saves most of the table and of the time to build it.  Queries
+   * longer than twice the largest power of two no larger than max_length,
+   * less one, are still answered, but from one entry of the deepest
+   * level for each of its intervals they span, in O(length / max_length).
+   */
+  sparse_rmq(iterator_type b, iterator_type e, unsigned threads = 1,
+             arena *storage = nullptr, difference_type max_length = 0)
+    : rmq_base(b, e),
+      _logn(max_level(n(), max_length)),
+      _level_offsets(level_offsets(n(), _logn, storage)),
+      _arr(_level_offsets[_logn + 1], storage)
+  {
+    RMQ_COUNT("sparse_rmq.builds");
+    RMQ_TIME("sparse_rmq.build.levels_ns");
+    fill_in(threads, std::integral_constant<
+              bool, simd::vector_min_level<value_type, index_type>::vectorized && !inline_values>());
+  }
+
+  /**
+   * Loads the tables for the array [b,e) saved by save(), viewing them in
+   * place.  See serialize.hpp.  max_length has to be what it was built
+   * with.
+   */
+  sparse_rmq(iterator_type b, iterator_type e, index_reader &in,
+             difference_type max_length = 0)
+    : rmq_base(b, e),
+      _logn(max_level(n(), max_length)),
+      _level_offsets(level_offsets(n(), _logn, nullptr))
   {
-    std::fill(_arr.begin(), _arr.end(),
-              std::vector<difference_type>());
+    in.read_header<value_type, index_type>(kind(), n(), header_param());
+    _arr = in.read_table<cell_type>(_level_offsets[_logn + 1]);
+  }
+
+  void save(index_writer &out) const {
+    out.write_header<value_type, index_type>(kind(), n(), header_param());
+    out.write_table(_arr);
+  }
 
-    fill_in();
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("levels", _arr.bytes_used());
+    usage.add("level_offsets", _level_offsets.bytes_used());
+    return usage;
   }
 
   difference_type query(iterator_type u, iterator_type v) const {
-    const level_type depth = std::max(level_type(0),
-                                      level_type(std::floor(std::log2(v-u-1))));
+    // The largest power of two no longer than the query covers it with
+    // two (possibly overlapping) intervals, unless max_length left out
+    // that level.
+    const level_type depth = std::min(lg(v - u), _logn);
     const iterator_type &b = begin();
     const auto x = u-b;
     const auto y = v-b;
-    const difference_type px = _arr[depth][x];
-    const difference_type py = _arr[depth][y-(1<<depth)];
-    return val(px) < val(py) ? px : py;
+    const cell_type *level = _arr.data() + _level_offsets[depth];
+    const cell_type &px = level[x];
+    const cell_type &py = level[y - (difference_type(1) << depth)];
+    if (y - x > difference_type(2) << depth) {
+      return index_of(*min_between(level, x, y, value_of(py) < value_of(px) ? &py : &px));
+    }
+    return value_of(px) < value_of(py) ? index_of(px) : index_of(py);
+  }
+
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    // Each query needs two table entries, and then (without
+    // inline_values) the two input values they point to.  We compute
+    // every query's table addresses first and prefetch them, then load
+    // the entries and prefetch the values, and only then compare, so that
+    // each phase's misses overlap instead of being serialized through the
+    // dependent loads of query().
+    const cell_type *xs[rmq_base::chunk_size];
+    const cell_type *ys[rmq_base::chunk_size];
+    for (size_t i = 0; i < count; ++i) {
+      const level_type depth = std::min(lg(vos[i] - uos[i]), _logn);
+      const cell_type *level = _arr.data() + _level_offsets[depth];
+      xs[i] = level + uos[i];
+      ys[i] = level + vos[i] - (difference_type(1) << depth);
+      prefetch(xs[i]);
+      prefetch(ys[i]);
+    }
+
+    if (!inline_values) {
+      for (size_t i = 0; i < count; ++i) {
+        prefetch(&value_of(*xs[i]));
+        prefetch(&value_of(*ys[i]));
+      }
+    }
+
+    const difference_type longest = difference_type(2) << _logn;
+    for (size_t i = 0; i < count; ++i) {
+      if (vos[i] - uos[i] > longest) {
+        const cell_type *level = _arr.data() + _level_offsets[_logn];
+        const cell_type *ends = value_of(*ys[i]) < value_of(*xs[i]) ? ys[i] : xs[i];
+        out[i] = index_of(*min_between(level, uos[i], vos[i], ends));
+        continue;
+      }
+      out[i] = value_of(*xs[i]) < value_of(*ys[i]) ? index_of(*xs[i]) : index_of(*ys[i]);
+    }
   }
 };
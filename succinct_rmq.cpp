@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+#include "succinct_rmq.hpp"
+#include "rmq_test.hpp"
+
+/**
+ * Checks queries of any length, including the whole input, against a
+ * scan for the leftmost minimum, which is what succinct_rmq returns.
+ * Long queries span superblocks, and their ends are looked up by select
+ * anywhere in the parentheses.
+ */
+void long_test(const std::vector<int> &input) {
+  typedef std::vector<int>::const_iterator iterator_type;
+  typedef std::vector<int>::difference_type difference_type;
+  const succinct_rmq<iterator_type> im(input.begin(), input.end());
+  const difference_type N = difference_type(input.size());
+  for (size_t i = 0; i < 300; ++i) {
+    difference_type u = std::rand() % N;
+    difference_type v = u + 1 + std::rand() % (N - u);
+    if (i == 0) {
+      u = 0;
+      v = N;
+    }
+    const difference_type expected =
+      std::min_element(input.begin() + u, input.begin() + v) - input.begin();
+    assert(im.query_offset(u, v) == expected);
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  RMQ_TEST_BODY(succinct_rmq, 1000000);
+
+  const size_t N = 200000;
+  std::vector<std::vector<int> > inputs(7, std::vector<int>(N));
+  for (size_t i = 0; i < N; ++i) {
+    inputs[0][i] = std::rand();
+    inputs[1][i] = std::rand() % 4;
+    inputs[2][i] = int(i);
+    inputs[3][i] = -int(i);
+    inputs[4][i] = 7;
+    // Increasing runs, each starting below everything before it, which
+    // close a run's worth of parentheses before the next '(': long
+    // enough to leave sparse select ranges, or just sparse subranges.
+    inputs[5][i] = int(i % 70000) - int(i / 70000) * 1000000;
+    inputs[6][i] = int(i % 3000) - int(i / 3000) * 10000;
+  }
+  for (const std::vector<int> &input : inputs) {
+    long_test(input);
+  }
+  return 0;
+}
@@ -0,0 +1,635 @@
+/**
+ * Implements a succinct <O(n), O(1)> RMQ solution, which stores the
+ * 2d-Min-Heap of the input (in the style of Fischer and Heun) as 2n+2
+ * bits of balanced parentheses, plus small directories, and never looks
+ * at the input again after construction.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "rmq.hpp"
+
+#include "sparse_rmq.hpp"
+
+template<
+  typename iterator_type,
+  typename value_type=typename std::iterator_traits<iterator_type>::value_type,
+  typename difference_type=typename std::iterator_traits<iterator_type>::difference_type
+  >
+class succinct_rmq : public rmq<succinct_rmq<iterator_type, value_type, difference_type>,
+                                 iterator_type, value_type, difference_type> {
+
+  typedef rmq<succinct_rmq, iterator_type, value_type, difference_type> rmq_base;
+
+  // Compilers are dumb.
+  using rmq_base::begin;
+  using rmq_base::end;
+  using rmq_base::n;
+  using rmq_base::val;
+  using rmq_base::lg;
+
+  /**
+   * The parentheses are stored one per bit, 1 for '(' and 0 for ')',
+   * with position p in bit p % 64 of word p / 64.
+   *
+   * We build the sequence with the same stack as the Cartesian tree
+   * construction: starting with a '(' for a virtual root, for each
+   * element we write a ')' for each larger element we pop off the stack,
+   * then a '(' as we push the element itself.  At the end we close
+   * everything still on the stack, and the root.  The depth ("excess") of
+   * the sequence after an element's '(' is then the number of elements on
+   * the stack, which are its ancestors in the 2d-Min-Heap.
+   *
+   * Write open(i) for the position of element i's '(' (the (i+1)th '('
+   * if the root's is the 0th), and E[p] for the excess after position p.
+   * If m is the leftmost minimum of [i, j], everything in [i, m) is
+   * popped just before m is pushed, but nothing below them on the stack
+   * is, and m stays on the stack from then through open(j).  So the
+   * rightmost minimum of E over [open(i) - 1, open(j) - 1] is at
+   * open(m) - 1, and m is the number of '('s before the next position,
+   * minus one for the root.
+   */
+  typedef uint64_t word_type;
+
+  static const size_t word_bits = 64;
+
+  /**
+   * The directories are kept per block of 512 bits (8 words).  Blocks
+   * are grouped into superblocks of 32 blocks.
+   */
+  static const size_t words_per_block = 8;
+  static const size_t block_bits = word_bits * words_per_block;
+  static const size_t blocks_per_superblock = 32;
+
+  /**
+   * Select splits the '('s into ranges of select_sample_rate, and those
+   * into subranges of select_subrange_rate.  A range spanning at least
+   * select_sparse_range bits has all its positions stored outright, as
+   * does a subrange (of a range that doesn't) spanning at least
+   * select_sparse_subrange bits.  Otherwise, a subrange's first position
+   * is stored relative to its range's, in 16 bits, and select scans from
+   * there, over fewer than select_sparse_subrange bits.  Stored positions
+   * take at most half a bit per parenthesis at either level.
+   */
+  static const size_t select_sample_rate = 512;
+  static const size_t select_subrange_rate = 64;
+  static const size_t select_subranges = select_sample_rate / select_subrange_rate;
+  static const size_t select_sparse_range = size_t(1) << 16;
+  static const size_t select_sparse_subrange = 2048;
+
+  /**
+   * In _select_ranges, the flag marking a range whose positions are all
+   * stored, and where the mask of a range's subranges whose are starts.
+   */
+  static const uint64_t select_sparse_flag = uint64_t(1) << 63;
+  static const size_t select_mask_shift = 48;
+
+  /**
+   * Levels 1 through short_levels of a sparse table over the blocks,
+   * which answers queries over up to 2^(short_levels+1) =
+   * blocks_per_superblock blocks.
+   */
+  static const size_t short_levels = 4;
+
+  /**
+   * Number of parentheses (2n+2).
+   */
+  size_t _len;
+
+  /**
+   * The parentheses themselves.
+   */
+  std::vector<word_type> _bits;
+
+  /**
+   * _block_rank[k] is the number of '('s before block k, with one extra
+   * entry at the end for the total.  Together with popcounts this gives
+   * rank in O(1), and with it the excess before any position:
+   * E[p - 1] = 2 * rank(p) - p.
+   */
+  std::vector<uint64_t> _block_rank;
+
+  /**
+   * The minimum excess within each word and each block, relative to the
+   * excess just before the word or block.
+   */
+  std::vector<int8_t> _word_min;
+  std::vector<int16_t> _block_min;
+
+  /**
+   * _short_table[(l - 1) * num_blocks() + k] is the offset from k of the
+   * (rightmost) block with the smallest minimum among blocks [k, k + 2^l).
+   */
+  std::vector<uint8_t> _short_table;
+
+  /**
+   * The smallest minimum excess within each superblock, and the block in
+   * which it occurs, and a sparse_rmq over them for queries spanning more
+   * than one superblock.  Block numbers are uint32_t, which handles
+   * inputs up to 2^40 elements.
+   */
+  std::vector<difference_type> _superblock_mins;
+  std::vector<uint32_t> _superblock_argmins;
+  std::unique_ptr<sparse_rmq<typename std::vector<difference_type>::const_iterator> > _superblock_rmq;
+
+  /**
+   * _select_samples[s] is the position of the (s * select_sample_rate)th
+   * '(', the first of range s.
+   */
+  std::vector<uint64_t> _select_samples;
+
+  /**
+   * _select_ranges[s] is, for a range with select_sparse_flag set, where
+   * its positions start in _select_positions.  For any other range, the
+   * low select_mask_shift bits are where the positions of its subranges
+   * that have them stored start in _select_subrange_positions, one
+   * subrange after another, and the bits above are the mask of those
+   * subranges.
+   */
+  std::vector<uint64_t> _select_ranges;
+  std::vector<uint64_t> _select_positions;
+
+  /**
+   * _select_subranges[s * select_subranges + j] is the position of the
+   * first '(' of range s's subrange j, relative to the range's first, and
+   * _select_subrange_positions holds stored subranges' positions the same
+   * way.  Ranges with stored positions have entries too, which are
+   * unused, so that they can be found without counting.
+   */
+  std::vector<uint16_t> _select_subranges;
+  std::vector<uint16_t> _select_subrange_positions;
+
+  /**
+   * Precomputed answers for scanning the excess over a byte of
+   * parentheses at a time: the change in excess over the byte, and the
+   * minimum (relative) excess after each of its bits and the rightmost bit
+   * at which it occurs.
+   */
+  struct byte_info {
+    int8_t total;
+    int8_t min;
+    uint8_t pos;
+  };
+
+  struct byte_table {
+    byte_info entries[256];
+
+    byte_table() {
+      for (unsigned x = 0; x < 256; ++x) {
+        int excess = 0;
+        int min = std::numeric_limits<int>::max();
+        unsigned pos = 0;
+        for (unsigned b = 0; b < 8; ++b) {
+          excess += ((x >> b) & 1) ? 1 : -1;
+          if (excess <= min) {
+            min = excess;
+            pos = b;
+          }
+        }
+        entries[x].total = int8_t(excess);
+        entries[x].min = int8_t(min);
+        entries[x].pos = uint8_t(pos);
+      }
+    }
+  };
+
+  static const byte_info *bytes() {
+    static const byte_table table;
+    return table.entries;
+  }
+
+  /**
+   * The best minimum excess found so far while scanning a range.  When we
+   * skip over a whole word or block using its stored minimum, we only
+   * know which word or block the minimum is in, so we remember where that
+   * word or block starts and the excess before it, and find the exact
+   * position later if it's still the best.
+   */
+  enum candidate_kind { exact, in_word, in_block };
+
+  struct candidate {
+    difference_type min;
+    size_t pos;
+    difference_type before;
+    candidate_kind kind;
+
+    candidate()
+      : min(std::numeric_limits<difference_type>::max()),
+        pos(0),
+        before(0),
+        kind(exact)
+    {}
+
+    /**
+     * Ties go to the later candidate, so that we find the rightmost
+     * minimum as long as we consider candidates left to right.
+     */
+    void consider(difference_type m, size_t p, difference_type b, candidate_kind k) {
+      if (m <= min) {
+        min = m;
+        pos = p;
+        before = b;
+        kind = k;
+      }
+    }
+  };
+
+  size_t num_blocks() const { return _block_rank.size() - 1; }
+
+  bool bit(size_t p) const {
+    return (_bits[p / word_bits] >> (p % word_bits)) & 1;
+  }
+
+  static difference_type word_excess(word_type w) {
+    return 2 * difference_type(__builtin_popcountll(w)) - difference_type(word_bits);
+  }
+
+  /**
+   * The number of '('s before position p.
+   */
+  uint64_t rank(size_t p) const {
+    const size_t k = p / block_bits;
+    uint64_t r = _block_rank[k];
+    for (size_t w = k * words_per_block; w < p / word_bits; ++w) {
+      r += __builtin_popcountll(_bits[w]);
+    }
+    if (p % word_bits) {
+      r += __builtin_popcountll(_bits[p / word_bits] & ((word_type(1) << (p % word_bits)) - 1));
+    }
+    return r;
+  }
+
+  /**
+   * The excess before position p, E[p - 1].
+   */
+  difference_type excess_before(size_t p) const {
+    return 2 * difference_type(rank(p)) - difference_type(p);
+  }
+
+  /**
+   * The position of the rth (counting from 0) '('.
+   */
+  size_t select(uint64_t r) const {
+    const size_t s = r / select_sample_rate;
+    const uint64_t range = _select_ranges[s];
+    if (range & select_sparse_flag) {
+      return _select_positions[(range & ~select_sparse_flag) + r % select_sample_rate];
+    }
+
+    const size_t j = (r % select_sample_rate) / select_subrange_rate;
+    const uint64_t mask = range >> select_mask_shift;
+    if ((mask >> j) & 1) {
+      const uint64_t first = (range & ((uint64_t(1) << select_mask_shift) - 1)) +
+        select_subrange_rate * __builtin_popcountll(mask & ((uint64_t(1) << j) - 1));
+      return _select_samples[s] + _select_subrange_positions[first + r % select_subrange_rate];
+    }
+
+    // Walk the words, then the bytes and bits, from the subrange's first
+    // '(', which is less than select_sparse_subrange bits away.
+    size_t p = _select_samples[s] + _select_subranges[s * select_subranges + j];
+    r %= select_subrange_rate;
+    word_type x = _bits[p / word_bits] >> (p % word_bits);
+    for (;;) {
+      const uint64_t c = __builtin_popcountll(x);
+      if (r < c) {
+        break;
+      }
+      r -= c;
+      p = (p / word_bits + 1) * word_bits;
+      x = _bits[p / word_bits];
+    }
+    for (;; x >>= 8, p += 8) {
+      const uint64_t c = __builtin_popcountll(x & 0xff);
+      if (r < c) {
+        break;
+      }
+      r -= c;
+    }
+    for (;; x >>= 1, ++p) {
+      if (x & 1) {
+        if (r == 0) {
+          return p;
+        }
+        --r;
+      }
+    }
+  }
+
+  /**
+   * Scans the excess over positions [p, q) a bit or a byte at a time,
+   * given the excess before p, and returns the excess before q.
+   */
+  difference_type scan_bits(size_t p, size_t q, difference_type excess, candidate &best) const {
+    for (; p < q && p % 8; ++p) {
+      excess += bit(p) ? 1 : -1;
+      best.consider(excess, p, 0, exact);
+    }
+    const byte_info *table = bytes();
+    for (; p + 8 <= q; p += 8) {
+      const byte_info &b = table[(_bits[p / word_bits] >> (p % word_bits)) & 0xff];
+      best.consider(excess + b.min, p + b.pos, 0, exact);
+      excess += b.total;
+    }
+    for (; p < q; ++p) {
+      excess += bit(p) ? 1 : -1;
+      best.consider(excess, p, 0, exact);
+    }
+    return excess;
+  }
+
+  /**
+   * Same as scan_bits, but skips over whole words using _word_min.
+   */
+  difference_type scan_words(size_t p, size_t q, difference_type excess, candidate &best) const {
+    while (p < q) {
+      if (p % word_bits == 0 && p + word_bits <= q) {
+        const word_type w = _bits[p / word_bits];
+        best.consider(excess + _word_min[p / word_bits], p, excess, in_word);
+        excess += word_excess(w);
+        p += word_bits;
+      } else {
+        const size_t next = std::min(q, (p / word_bits + 1) * word_bits);
+        excess = scan_bits(p, next, excess, best);
+        p = next;
+      }
+    }
+    return excess;
+  }
+
+  /**
+   * Narrows a candidate down to its exact position.
+   */
+  void resolve(candidate &best) const {
+    if (best.kind == in_block) {
+      candidate c;
+      scan_words(best.pos, std::min(_len, best.pos + block_bits), best.before, c);
+      best = c;
+    }
+    if (best.kind == in_word) {
+      candidate c;
+      scan_bits(best.pos, std::min(_len, best.pos + word_bits), best.before, c);
+      best = c;
+    }
+  }
+
+  /**
+   * The minimum excess within block k.
+   */
+  difference_type block_min(size_t k) const {
+    return 2 * difference_type(_block_rank[k]) - difference_type(k * block_bits) + _block_min[k];
+  }
+
+  /**
+   * Of blocks x and y, the one with the smaller minimum, or the later one
+   * if they're equal.
+   */
+  size_t min_block(size_t x, size_t y) const {
+    const difference_type mx = block_min(x);
+    const difference_type my = block_min(y);
+    return (mx < my || (mx == my && x > y)) ? x : y;
+  }
+
+  /**
+   * The rightmost block with the smallest minimum among blocks [k1, k2],
+   * where k2 - k1 < blocks_per_superblock.
+   */
+  size_t short_query(size_t k1, size_t k2) const {
+    const size_t full_level = size_t(lg(k2 - k1 + 1));
+    const size_t level = full_level < short_levels ? full_level : short_levels;
+    if (level == 0) {
+      return min_block(k1, k2);
+    }
+    const size_t y = k2 + 1 - (size_t(1) << level);
+    const uint8_t *offsets = _short_table.data() + (level - 1) * num_blocks();
+    return min_block(k1 + offsets[k1], y + offsets[y]);
+  }
+
+  /**
+   * The rightmost block with the smallest minimum among blocks [k1, k2].
+   */
+  size_t block_query(size_t k1, size_t k2) const {
+    if (k2 - k1 < blocks_per_superblock) {
+      return short_query(k1, k2);
+    }
+    // Split into the superblocks entirely inside the range, and the
+    // pieces of superblocks at either end.
+    const size_t s1 = (k1 + blocks_per_superblock - 1) / blocks_per_superblock;
+    const size_t s2 = (k2 + 1) / blocks_per_superblock;
+    if (s1 >= s2) {
+      const size_t split = s1 * blocks_per_superblock;
+      return min_block(short_query(k1, split - 1), short_query(split, k2));
+    }
+    size_t best = _superblock_argmins[_superblock_rmq->query_offset(s1, s2)];
+    if (k1 < s1 * blocks_per_superblock) {
+      best = min_block(short_query(k1, s1 * blocks_per_superblock - 1), best);
+    }
+    if (s2 * blocks_per_superblock <= k2) {
+      best = min_block(best, short_query(s2 * blocks_per_superblock, k2));
+    }
+    return best;
+  }
+
+  /**
+   * The position of the rightmost minimum excess among positions [a, b].
+   */
+  size_t excess_query(size_t a, size_t b) const {
+    const size_t ka = a / block_bits;
+    const size_t kb = b / block_bits;
+    candidate best;
+    if (ka == kb) {
+      scan_words(a, b + 1, excess_before(a), best);
+    } else {
+      scan_words(a, (ka + 1) * block_bits, excess_before(a), best);
+      if (ka + 1 < kb) {
+        const size_t k = block_query(ka + 1, kb - 1);
+        best.consider(block_min(k), k * block_bits,
+                      excess_before(k * block_bits), in_block);
+      }
+      scan_words(kb * block_bits, b + 1, excess_before(kb * block_bits), best);
+    }
+    resolve(best);
+    return best.pos;
+  }
+
+  /**
+   * Writes the parentheses sequence.
+   */
+  void fill_in_bits() {
+    _len = 2 * size_t(n()) + 2;
+    _bits.assign((_len + word_bits - 1) / word_bits, 0);
+    size_t p = 0;
+    auto push_bit = [this, &p](bool b) {
+      if (b) {
+        _bits[p / word_bits] |= word_type(1) << (p % word_bits);
+      }
+      ++p;
+    };
+
+    // The stack holds the rightmost path of the Cartesian tree, it's only
+    // needed during construction.
+    std::vector<difference_type> stack;
+    push_bit(true);
+    for (difference_type i = 0; i < n(); ++i) {
+      while (!stack.empty() && val(i) < val(stack.back())) {
+        stack.pop_back();
+        push_bit(false);
+      }
+      stack.push_back(i);
+      push_bit(true);
+    }
+    for (size_t i = 0; i <= stack.size(); ++i) {
+      push_bit(false);
+    }
+  }
+
+  /**
+   * Fills in the rank and minimum directories.
+   */
+  void fill_in_directories() {
+    const size_t nwords = _bits.size();
+    const size_t nblocks = (_len + block_bits - 1) / block_bits;
+    _word_min.resize(nwords);
+    _block_min.resize(nblocks);
+    _block_rank.resize(nblocks + 1);
+
+    uint64_t ones = 0;
+    for (size_t k = 0; k < nblocks; ++k) {
+      _block_rank[k] = ones;
+      difference_type block_excess = 0;
+      difference_type block_min = std::numeric_limits<difference_type>::max();
+      for (size_t w = k * words_per_block; w < std::min(nwords, (k + 1) * words_per_block); ++w) {
+        candidate word_best;
+        const size_t begin_bit = w * word_bits;
+        const size_t end_bit = std::min(_len, begin_bit + word_bits);
+        scan_bits(begin_bit, end_bit, 0, word_best);
+        _word_min[w] = int8_t(word_best.min);
+        block_min = std::min(block_min, block_excess + word_best.min);
+        block_excess += word_excess(_bits[w]);
+        ones += __builtin_popcountll(_bits[w]);
+      }
+      _block_min[k] = int16_t(block_min);
+    }
+    _block_rank[nblocks] = ones;
+  }
+
+  /**
+   * Fills in the select directory for the range of '('s at positions.
+   */
+  void fill_in_select_range(const std::vector<uint64_t> &positions) {
+    const uint64_t start = positions.front();
+    _select_samples.push_back(start);
+    const size_t subranges_begin = _select_subranges.size();
+    _select_subranges.resize(subranges_begin + select_subranges);
+    if (positions.back() - start >= select_sparse_range) {
+      _select_ranges.push_back(_select_positions.size() | select_sparse_flag);
+      _select_positions.insert(_select_positions.end(), positions.begin(), positions.end());
+      return;
+    }
+
+    uint64_t range = _select_subrange_positions.size();
+    for (size_t j = 0; j * select_subrange_rate < positions.size(); ++j) {
+      const size_t first = j * select_subrange_rate;
+      const size_t last = std::min(positions.size(), first + select_subrange_rate) - 1;
+      _select_subranges[subranges_begin + j] = uint16_t(positions[first] - start);
+      if (positions[last] - positions[first] >= select_sparse_subrange) {
+        range |= uint64_t(1) << (select_mask_shift + j);
+        for (size_t k = first; k <= last; ++k) {
+          _select_subrange_positions.push_back(uint16_t(positions[k] - start));
+        }
+      }
+    }
+    _select_ranges.push_back(range);
+  }
+
+  /**
+   * Fills in the select directory, a range at a time.
+   */
+  void fill_in_select() {
+    std::vector<uint64_t> positions;
+    for (size_t w = 0; w < _bits.size(); ++w) {
+      for (word_type x = _bits[w]; x; x &= x - 1) {
+        positions.push_back(w * word_bits + size_t(__builtin_ctzll(x)));
+        if (positions.size() == select_sample_rate) {
+          fill_in_select_range(positions);
+          positions.clear();
+        }
+      }
+    }
+    if (!positions.empty()) {
+      fill_in_select_range(positions);
+    }
+    _select_samples.shrink_to_fit();
+    _select_ranges.shrink_to_fit();
+    _select_positions.shrink_to_fit();
+    _select_subranges.shrink_to_fit();
+    _select_subrange_positions.shrink_to_fit();
+  }
+
+  /**
+   * Fills in _short_table and the superblock structure.
+   */
+  void fill_in_block_tables() {
+    const size_t nblocks = num_blocks();
+    _short_table.resize(short_levels * nblocks);
+    for (size_t level = 1; level <= short_levels; ++level) {
+      uint8_t *offsets = _short_table.data() + (level - 1) * nblocks;
+      const uint8_t *prev = level > 1 ? _short_table.data() + (level - 2) * nblocks : nullptr;
+      const size_t half = size_t(1) << (level - 1);
+      for (size_t k = 0; k < nblocks; ++k) {
+        const size_t x = k + (prev ? prev[k] : 0);
+        if (k + half < nblocks) {
+          const size_t y = k + half + (prev ? prev[k + half] : 0);
+          offsets[k] = uint8_t(min_block(x, y) - k);
+        } else {
+          offsets[k] = uint8_t(x - k);
+        }
+      }
+    }
+
+    for (size_t k = 0; k < nblocks; k += blocks_per_superblock) {
+      const size_t argmin = short_query(k, std::min(nblocks, k + blocks_per_superblock) - 1);
+      _superblock_argmins.push_back(uint32_t(argmin));
+      _superblock_mins.push_back(block_min(argmin));
+    }
+    _superblock_rmq.reset(new sparse_rmq<typename std::vector<difference_type>::const_iterator>(_superblock_mins.begin(), _superblock_mins.end()));
+  }
+
+public:
+  succinct_rmq(iterator_type b, iterator_type e)
+    : rmq_base(b, e)
+  {
+    fill_in_bits();
+    fill_in_directories();
+    fill_in_select();
+    fill_in_block_tables();
+  }
+
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("parentheses", vector_bytes(_bits));
+    usage.add("block_rank", vector_bytes(_block_rank));
+    usage.add("minima", vector_bytes(_word_min) + vector_bytes(_block_min));
+    usage.add("short_table", vector_bytes(_short_table));
+    usage.add("superblocks", vector_bytes(_superblock_mins) + vector_bytes(_superblock_argmins));
+    usage.add("superblock_rmq", _superblock_rmq->memory_usage());
+    usage.add("select", vector_bytes(_select_samples) + vector_bytes(_select_ranges) +
+              vector_bytes(_select_positions) + vector_bytes(_select_subranges) +
+              vector_bytes(_select_subrange_positions));
+    return usage;
+  }
+
+  difference_type query(iterator_type u, iterator_type v) const {
+    const uint64_t i = u - begin();
+    const uint64_t j = v - 1 - begin();
+    // Element i's '(' is the (i+1)th, after the root's.
+    const size_t p = excess_query(select(i + 1) - 1, select(j + 1) - 1);
+    return difference_type(rank(p + 1)) - 1;
+  }
+};
@@ -0,0 +1,192 @@
+/**
+ * Defines the flat arrays the implementations keep their precomputed
+ * answers in.
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+
+/**
+ * A fixed-size array that either owns its elements, when an
+ * implementation builds it, or views elements somebody else owns, when
+ * it's loaded from a memory-mapped index (see serialize.hpp).  Either
+ * way queries just read through data().
+ *
+ * Owned elements are either in a vector of the table's own or, when the
+ * implementation was given an arena, in memory carved from it, which the
+ * table keeps alive.  Only owned tables can be written to.  A view keeps
+ * whatever owns its elements alive through keepalive.
+ */
+template<typename T>
+class table {
+  std::vector<T> _owned;
+
+  /**
+   * The elements, if they're ours to write, or null for a view.
+   */
+  T *_writable;
+
+  const T *_data;
+  size_t _size;
+  std::shared_ptr<const void> _keepalive;
+
+  bool in_arena() const { return _writable && _owned.empty(); }
+
+  /**
+   * Zeroes the bytes of size elements at p, padding and all, for the
+   * structs some implementations keep in tables: value-initializing them
+   * needn't touch their padding, and saving them would then write
+   * whatever bytes were there before.
+   */
+  static void zero(T *p, size_t size, std::true_type) {
+    std::memset(static_cast<void *>(p), 0, size * sizeof(T));
+  }
+
+  static void zero(T *, size_t, std::false_type) {}
+
+  static void zero(T *p, size_t size) {
+    zero(p, size, std::integral_constant<bool, std::is_class<T>::value &&
+                                          std::is_trivially_copyable<T>::value>());
+  }
+
+public:
+  typedef T value_type;
+  typedef const T *const_iterator;
+
+  table()
+    : _writable(nullptr),
+      _data(nullptr),
+      _size(0)
+  {}
+
+  /**
+   * An owned table of size value-initialized elements, taken from
+   * storage if it's given.
+   */
+  explicit table(size_t size, arena *storage = nullptr)
+    : _writable(nullptr),
+      _data(nullptr),
+      _size(size)
+  {
+    if (size == 0) {
+      return;
+    } else if (storage) {
+      static_assert(std::is_trivially_destructible<T>::value,
+                    "arenas never run destructors");
+      _writable = static_cast<T *>(storage->allocate(size * sizeof(T)));
+      std::uninitialized_fill_n(_writable, size, T());
+      _keepalive = storage->keepalive();
+    } else {
+      _owned.resize(size);
+      _writable = _owned.data();
+    }
+    zero(_writable, size);
+    _data = _writable;
+  }
+
+  /**
+   * A view of the size elements at data, which keepalive (if any) keeps
+   * from going away.
+   */
+  table(const T *data, size_t size, std::shared_ptr<const void> keepalive)
+    : _writable(nullptr),
+      _data(data),
+      _size(size),
+      _keepalive(std::move(keepalive))
+  {}
+
+  /**
+   * Copies of owned tables get elements of their own (in a vector, even
+   * if the original's are in an arena), copies of views view the same
+   * elements.
+   */
+  table(const table &other)
+    : _writable(nullptr),
+      _data(other._data),
+      _size(other._size)
+  {
+    if (other._writable) {
+      _owned.assign(other._data, other._data + other._size);
+      _writable = _owned.data();
+      _data = _writable;
+    } else {
+      _keepalive = other._keepalive;
+    }
+  }
+
+  table(table &&other)
+    : _owned(std::move(other._owned)),
+      _writable(other._writable),
+      _data(other._data),
+      _size(other._size),
+      _keepalive(std::move(other._keepalive))
+  {
+    other._writable = nullptr;
+    other._data = nullptr;
+    other._size = 0;
+  }
+
+  table &operator=(table other) {
+    swap(other);
+    return *this;
+  }
+
+  void swap(table &other) {
+    // Swapping vectors keeps their elements where they are, so owned
+    // tables' data pointers stay right.
+    _owned.swap(other._owned);
+    std::swap(_writable, other._writable);
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    _keepalive.swap(other._keepalive);
+  }
+
+  /**
+   * Whether the elements are our own, rather than a view.
+   */
+  bool owned() const { return _writable || _size == 0; }
+
+  /**
+   * The bytes allocated for the elements (from the heap or an arena),
+   * which for a view is none.
+   */
+  size_t bytes_used() const {
+    return in_arena() ? _size * sizeof(T) : _owned.capacity() * sizeof(T);
+  }
+
+  size_t size() const { return _size; }
+
+  bool empty() const { return _size == 0; }
+
+  const T *data() const { return _data; }
+
+  const T *begin() const { return _data; }
+
+  const T *end() const { return _data + _size; }
+
+  const T *cbegin() const { return _data; }
+
+  const T *cend() const { return _data + _size; }
+
+  const T &operator[](size_t i) const { return _data[i]; }
+
+  T *data() {
+    assert(owned());
+    return _writable;
+  }
+
+  T *begin() { return data(); }
+
+  T *end() { return data() + _size; }
+
+  T &operator[](size_t i) { return data()[i]; }
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <iterator>
 #include <vector>
 
 /**
@@ -26,14 +28,15 @@ private:
 
 public:
 
-  tree() {}
+  tree() : _repr(0) {}
 
   /**
    * Constructs a leaf node.
    */
   tree(const value_type &i)
     : _id(i),
-      _children()
+      _children(),
+      _repr(0)
   {}
 
   // No vector copying allowed.
@@ -44,7 +47,8 @@ public:
    */
   tree(const value_type &i, std::vector<tree> &&c)
     : _id(i),
-      _children(std::move(c))
+      _children(std::move(c)),
+      _repr(0)
   {}
 
   /**
@@ -59,6 +63,21 @@ public:
   // No copying allowed.
   tree(const tree &o) = delete;
 
+  /**
+   * Destroys the subtree without recursing once per level, so that very
+   * deep trees don't overflow the stack: we keep moving the children of
+   * the nodes we're about to destroy into one flat list first.
+   */
+  ~tree() {
+    std::vector<tree> pending(std::move(_children));
+    while (!pending.empty()) {
+      tree t(std::move(pending.back()));
+      pending.pop_back();
+      std::move(t._children.begin(), t._children.end(), std::back_inserter(pending));
+      t._children.clear();
+    }
+  }
+
   /**
    * Move assignment.
    */
@@ -0,0 +1,69 @@
+/**
+ * Trees for the LCA tests.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <sys/types.h>
+#include <utility>
+#include <vector>
+
+#include "tree.hpp"
+
+namespace tree_test {
+
+  /**
+   * A random parent array of n nodes: node 0 is the root, with parent
+   * -1, and node i > 0 is a child of a random node before it.
+   */
+  inline std::vector<ssize_t> random_parents(size_t n) {
+    std::vector<ssize_t> parents(n, -1);
+    for (size_t i = 1; i < n; ++i) {
+      parents[i] = ssize_t(size_t(std::rand()) % i);
+    }
+    return parents;
+  }
+
+  /**
+   * The tree of parents (as random_parents makes them), with node i's id
+   * i.  Since every node's parent comes before it, building the nodes
+   * from the last one back can move each into its parent.
+   */
+  inline tree<int> from_parents(const std::vector<ssize_t> &parents) {
+    const size_t n = parents.size();
+    std::vector<std::vector<tree<int> > > children(n);
+    for (size_t i = n - 1; i > 0; --i) {
+      children[parents[i]].push_back(tree<int>(int(i), std::move(children[i])));
+    }
+    return tree<int>(0, std::move(children[0]));
+  }
+
+  /**
+   * A path of depth nodes with ids 0 (the root) through depth - 1, deep
+   * enough, for the depths the tests use, that a recursive traversal
+   * would be in danger of overflowing the stack.
+   */
+  inline tree<int> path(int depth) {
+    tree<int> p(depth - 1);
+    for (int i = depth - 2; i >= 0; --i) {
+      std::vector<tree<int> > children;
+      children.push_back(std::move(p));
+      p = tree<int>(i, std::move(children));
+    }
+    return p;
+  }
+
+  /**
+   * The nodes of a path, from the root down, so that node i is at i.
+   */
+  inline std::vector<const tree<int> *> path_nodes(const tree<int> &p) {
+    std::vector<const tree<int> *> nodes(1, &p);
+    while (!nodes.back()->children().empty()) {
+      nodes.push_back(&nodes.back()->children()[0]);
+    }
+    return nodes;
+  }
+
+}
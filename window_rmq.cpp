@@ -0,0 +1,114 @@
+#include <assert.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+#include "window_rmq.hpp"
+
+typedef window_rmq<int> impl;
+typedef std::ptrdiff_t difference_type;
+
+/**
+ * Checks the window's minimum and a few random queries against the
+ * leftmost minimum of a copy of the window found by brute force.
+ */
+static void check(const impl &im, const std::deque<int> &expected) {
+  assert(im.n() == difference_type(expected.size()));
+  if (expected.empty()) {
+    return;
+  }
+  const difference_type argmin = std::min_element(expected.begin(), expected.end()) - expected.begin();
+  assert(im.argmin() == argmin);
+  assert(im.min() == expected[argmin]);
+  for (size_t q = 0; q < 4; ++q) {
+    const difference_type u = std::rand() % im.n();
+    const difference_type v = u + 1 + std::rand() % (im.n() - u);
+    assert(im.query_offset(u, v) ==
+           std::min_element(expected.begin() + u, expected.begin() + v) - expected.begin());
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  {
+    impl im;
+    const int input[] = { 3, 1, 2, 1, 4, 5 };
+    for (size_t i = 0; i < 6; ++i) {
+      im.push(input[i]);
+    }
+    assert(im.argmin() == 1);
+    assert(im.min() == 1);
+    assert(im.query_offset(2, 6) == 3);
+    assert(im.query_offset(4, 6) == 4);
+    im.pop_front();
+    im.pop_front();
+    assert(im.start() == 2);
+    assert(im.argmin() == 1);
+    assert(im[0] == 2);
+    im.pop_front();
+    im.pop_front();
+    assert(im.argmin() == 0);
+    assert(im.min() == 4);
+  }
+
+  {
+    // A stream with a fixed size window, and then a window that grows
+    // and shrinks at random, so the ring wraps and grows.
+    impl im;
+    std::deque<int> expected;
+    const size_t window = 100;
+    for (size_t i = 0; i < 10000; ++i) {
+      im.push(std::rand() % 50);
+      expected.push_back(im[im.n() - 1]);
+      if (expected.size() > window) {
+        im.pop_front();
+        expected.pop_front();
+      }
+      check(im, expected);
+    }
+    for (size_t i = 0; i < 20000; ++i) {
+      if (std::rand() % 5 < 3 || expected.empty()) {
+        im.push(std::rand() % 50);
+        expected.push_back(im[im.n() - 1]);
+      } else {
+        im.pop_front();
+        expected.pop_front();
+      }
+      check(im, expected);
+    }
+
+    std::vector<std::pair<difference_type, difference_type> > queries;
+    for (size_t i = 0; i < 10000; ++i) {
+      const difference_type u = std::rand() % im.n();
+      queries.push_back(std::make_pair(u, u + 1 + std::rand() % (im.n() - u)));
+    }
+    std::vector<difference_type> answers;
+    im.query_batch(queries.begin(), queries.end(), std::back_inserter(answers));
+    assert(answers.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      assert(answers[i] == im.query_offset(queries[i].first, queries[i].second));
+    }
+  }
+
+  {
+    // A window of many blocks, so queries combine partial blocks with
+    // the blocks' minima, across the ring's wrap.
+    impl im;
+    std::deque<int> expected;
+    const size_t window = 1000;
+    for (size_t i = 0; i < 10000; ++i) {
+      im.push(std::rand() % 1000);
+      expected.push_back(im[im.n() - 1]);
+      if (expected.size() > window) {
+        im.pop_front();
+        expected.pop_front();
+      }
+      check(im, expected);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * Implements RMQ over a sliding window of a stream: amortized O(1)
+ * push and pop_front, O(1) minimum of the whole window and O(log W)
+ * queries on any part of it.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "dynamic_rmq.hpp"
+#include "rmq.hpp"
+
+/**
+ * Values are pushed onto the back of the window and popped off its
+ * front.  Offsets, both in queries and in answers, count from the front
+ * of the window as it is at the time, like query_offset's do from the
+ * beginning of an array, so they shift down by one with every
+ * pop_front.  start() is the position in the stream of the front of the
+ * window, to convert between the two.
+ *
+ * The minimum of the whole window comes from a monotonic deque: the
+ * positions of the values that are smaller than everything pushed after
+ * them, oldest first, so the oldest is the window's (leftmost) minimum.
+ *
+ * The values are kept in a ring buffer, which doubles in size when the
+ * window outgrows it, cut into blocks of block_size slots.  Each time a
+ * push fills a block's last slot, the block's minimum is found and put
+ * in a dynamic_rmq over the blocks' minima, so a push only costs
+ * O(log W) once per block, which block_size covers for any window that
+ * fits in memory.  Other ranges are answered by scanning the partial
+ * blocks at either end and asking the dynamic_rmq for the whole blocks
+ * in between, like block_rmq does.  Blocks the window only partly
+ * covers may have stale minima, but a query only asks for whole blocks
+ * inside the window, which were all filled since they last changed.
+ *
+ * Ties go to the leftmost minimum.  value_type must be default
+ * constructible, to fill the unused part of the ring.
+ */
+template<
+  typename value_type,
+  typename difference_type=std::ptrdiff_t,
+  typename index_type=difference_type
+  >
+class window_rmq {
+public:
+  static const size_t chunk_size = rmq_chunk_size;
+
+private:
+  typedef dynamic_rmq<value_type, difference_type, index_type> block_rmq_type;
+
+  static const difference_type block_size = 64;
+
+  /**
+   * The ring buffer, whose size is always a power of two and a multiple
+   * of block_size.  The window occupies _size slots from _start_slot,
+   * wrapping around the end.
+   */
+  std::vector<value_type> _ring;
+  difference_type _start_slot;
+  difference_type _size;
+
+  /**
+   * The slot of each block's minimum as of when its last slot was
+   * filled, and a dynamic_rmq over the minima themselves.
+   */
+  std::vector<index_type> _block_argmins;
+  block_rmq_type _block_rmq;
+
+  /**
+   * The position in the stream of the front of the window.
+   */
+  difference_type _start;
+
+  /**
+   * Stream positions of the window's values that are smaller than every
+   * value after them, oldest first.  Each value's position is pushed and
+   * popped at most once, which is what makes push and pop_front
+   * amortized O(1).
+   */
+  std::deque<difference_type> _minima;
+
+  difference_type capacity() const { return _ring.size(); }
+
+  difference_type slot(difference_type offset) const {
+    return (_start_slot + offset) & (capacity() - 1);
+  }
+
+  const value_type &at_position(difference_type position) const {
+    return (*this)[position - _start];
+  }
+
+  /**
+   * The slot of the leftmost minimum among slots [a, b), without
+   * wrapping.
+   */
+  difference_type scan(difference_type a, difference_type b) const {
+    difference_type best = a;
+    for (difference_type s = a + 1; s < b; ++s) {
+      if (_ring[s] < _ring[best]) {
+        best = s;
+      }
+    }
+    return best;
+  }
+
+  /**
+   * Finds block k's minimum and puts it in the dynamic_rmq.
+   */
+  void fill_in_block(difference_type k) {
+    const difference_type argmin = scan(k * block_size, (k + 1) * block_size);
+    _block_argmins[k] = index_type(argmin);
+    _block_rmq.update(k, _ring[argmin]);
+  }
+
+  /**
+   * The slot of the leftmost minimum among slots [a, b), without
+   * wrapping, all of which are in the window.
+   */
+  difference_type query_slots(difference_type a, difference_type b) const {
+    const difference_type ka = (a + block_size - 1) / block_size;
+    const difference_type kb = b / block_size;
+    if (ka >= kb) {
+      return scan(a, b);
+    }
+    difference_type best = _block_argmins[_block_rmq.query_offset(ka, kb)];
+    if (a < ka * block_size) {
+      const difference_type head = scan(a, ka * block_size);
+      best = _ring[best] < _ring[head] ? best : head;
+    }
+    if (kb * block_size < b) {
+      const difference_type tail = scan(kb * block_size, b);
+      best = _ring[tail] < _ring[best] ? tail : best;
+    }
+    return best;
+  }
+
+  /**
+   * Moves the window to the front of a ring of the given capacity, and
+   * fills in the blocks it covers.
+   */
+  void resize(difference_type new_capacity) {
+    std::vector<value_type> values(new_capacity);
+    for (difference_type i = 0; i < _size; ++i) {
+      values[i] = (*this)[i];
+    }
+    _ring.swap(values);
+    _start_slot = 0;
+    _block_argmins.assign(new_capacity / block_size, 0);
+    _block_rmq = block_rmq_type(_ring.begin(), _ring.begin() + new_capacity / block_size);
+    for (difference_type k = 0; k < _size / block_size; ++k) {
+      fill_in_block(k);
+    }
+  }
+
+public:
+  /**
+   * An empty window.
+   */
+  window_rmq()
+    : _start_slot(0),
+      _size(0),
+      _start(0)
+  {
+    resize(block_size);
+  }
+
+  /**
+   * Window size.
+   */
+  difference_type n() const { return _size; }
+
+  /**
+   * The position in the stream (counting from the first value ever
+   * pushed) of the front of the window.
+   */
+  difference_type start() const { return _start; }
+
+  /**
+   * The deque's elements are counted, but not its own bookkeeping.
+   */
+  memory_breakdown memory_usage() const {
+    memory_breakdown usage;
+    usage.add("ring", vector_bytes(_ring));
+    usage.add("block_argmins", vector_bytes(_block_argmins));
+    usage.add("block_rmq", _block_rmq.memory_usage());
+    usage.add("minima", _minima.size() * sizeof(difference_type));
+    return usage;
+  }
+
+  size_t bytes_used() const {
+    return memory_usage().total();
+  }
+
+  /**
+   * The value at offset i from the front of the window.
+   *
+   * Preconditions:
+   *  0 <= i < n()
+   */
+  const value_type &operator[](difference_type i) const {
+    return _ring[slot(i)];
+  }
+
+  /**
+   * Appends value to the back of the window.
+   */
+  void push(const value_type &value) {
+    if (_size == capacity()) {
+      resize(2 * capacity());
+    }
+    const difference_type s = slot(_size);
+    _ring[s] = value;
+    ++_size;
+    if ((s + 1) % block_size == 0) {
+      fill_in_block(s / block_size);
+    }
+
+    // Anything larger than the new value can't be the minimum of the
+    // window again before the new value leaves it.  Equal values stay,
+    // so the oldest minimum is the one at the front.
+    while (!_minima.empty() && value < at_position(_minima.back())) {
+      _minima.pop_back();
+    }
+    _minima.push_back(_start + _size - 1);
+  }
+
+  /**
+   * Drops the value at the front of the window.
+   *
+   * Preconditions:
+   *  n() > 0
+   */
+  void pop_front() {
+    if (_minima.front() == _start) {
+      _minima.pop_front();
+    }
+    _start_slot = slot(1);
+    --_size;
+    ++_start;
+  }
+
+  /**
+   * The offset of the minimum of the whole window.
+   *
+   * Preconditions:
+   *  n() > 0
+   */
+  difference_type argmin() const {
+    return _minima.front() - _start;
+  }
+
+  /**
+   * The minimum of the whole window.
+   *
+   * Preconditions:
+   *  n() > 0
+   */
+  const value_type &min() const {
+    return at_position(_minima.front());
+  }
+
+  /**
+   * Queries for the offset of the minimum value in [uo, vo), as offsets
+   * from the front of the window.
+   *
+   * Preconditions:
+   *  0 <= uo < vo <= n().
+   */
+  difference_type query_offset(difference_type uo, difference_type vo) const {
+    if (uo == 0 && vo == _size) {
+      return argmin();
+    }
+
+    // The range might wrap around the end of the ring, in which case we
+    // query both pieces and prefer the earlier on ties.
+    const difference_type u_slot = slot(uo);
+    const difference_type len = vo - uo;
+    difference_type best_slot;
+    if (u_slot + len <= capacity()) {
+      best_slot = query_slots(u_slot, u_slot + len);
+    } else {
+      const difference_type first = query_slots(u_slot, capacity());
+      const difference_type second = query_slots(0, u_slot + len - capacity());
+      best_slot = _ring[second] < _ring[first] ? second : first;
+    }
+    return (best_slot - _start_slot) & (capacity() - 1);
+  }
+
+  /**
+   * Answers the queries in [first, last), which should be a range of
+   * (uo, vo) pairs of offsets like those passed to query_offset, and
+   * writes the answers to out, in order.
+   */
+  template<
+    typename InputIterator,
+    typename OutputIterator
+    >
+  OutputIterator query_batch(InputIterator first, InputIterator last,
+                             OutputIterator out) const {
+    return query_batch_in_chunks<difference_type>(*this, first, last, out);
+  }
+
+  /**
+   * Answers count (at most chunk_size) queries, the ith of which is
+   * query_offset(uos[i], vos[i]), writing the ith answer to out[i].
+   */
+  void query_chunk(const difference_type *uos, const difference_type *vos,
+                   size_t count, difference_type *out) const {
+    for (size_t i = 0; i < count; ++i) {
+      out[i] = query_offset(uos[i], vos[i]);
+    }
+  }
+};